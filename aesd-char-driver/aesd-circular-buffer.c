@@ -20,6 +20,17 @@
 
 #include "aesd-circular-buffer.h"
 
+/**
+ * @return the entry @param index entries after the oldest one in @param buffer.
+ */
+static struct aesd_buffer_entry* aesd_circular_buffer_entry_at(
+		struct aesd_circular_buffer* buffer,
+		unsigned int index
+)
+{
+	return &buffer->entry[(buffer->out_offs + index) % buffer->capacity];
+}
+
 /**
  * @param buffer the buffer to search for corresponding offset. Any necessary locking must be performed by caller.
  * @param char_offset the position to search for in the buffer list, describing the zero referenced character index if all buffer strings were concatenated end to end
@@ -32,19 +43,68 @@ struct aesd_buffer_entry* aesd_circular_buffer_find_entry_offset_for_fpos(
 		size_t* entry_offset_byte_rtn
 )
 {
-	size_t pos_bytes = 0;
-	unsigned int pos = buffer->out_offs;
-	do
-	{
-		if( char_offset < pos_bytes + buffer->entry[pos].size ) {
-			(*entry_offset_byte_rtn) = char_offset - pos_bytes;
-			return &buffer->entry[pos];
+	struct aesd_circular_buffer_iter iter;
+	return aesd_circular_buffer_iter_seek( buffer, &iter, char_offset, entry_offset_byte_rtn );
+}
+
+/**
+ * Binary searches @param buffer for @param char_offset like aesd_circular_buffer_find_entry_offset_for_fpos()
+ * and positions @param iter so aesd_circular_buffer_iter_next() continues with the following entry.
+ * Any necessary locking must be performed by caller.
+ */
+struct aesd_buffer_entry* aesd_circular_buffer_iter_seek(
+		struct aesd_circular_buffer* buffer,
+		struct aesd_circular_buffer_iter* iter,
+		size_t char_offset,
+		size_t* entry_offset_byte_rtn
+)
+{
+	// start_offs only grows (modulo wrap around), relative to the oldest entry it is sorted:
+	size_t first_offset = aesd_circular_buffer_first_offset( buffer );
+	unsigned int low = 0;
+	unsigned int high = aesd_circular_buffer_get_count( buffer );
+	if( char_offset >= buffer->total_size ) {
+		return NULL;
+	}
+	// find the last entry starting at or before char_offset:
+	high--;
+	while( low < high ) {
+		unsigned int middle = low + (high - low + 1) / 2;
+		if( aesd_circular_buffer_entry_at( buffer, middle )->start_offs - first_offset <= char_offset ) {
+			low = middle;
+		}
+		else {
+			high = middle - 1;
 		}
-		pos_bytes += buffer->entry[pos].size;
-		pos = (pos + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
 	}
-	while( pos != buffer->out_offs );
-	return NULL;
+	(*entry_offset_byte_rtn) = char_offset - (aesd_circular_buffer_entry_at( buffer, low )->start_offs - first_offset);
+	iter->index = low + 1;
+	return aesd_circular_buffer_entry_at( buffer, low );
+}
+
+/**
+ * @return the entry following the one last returned through @param iter, or NULL after the newest entry.
+ * Any necessary locking must be performed by caller.
+ */
+struct aesd_buffer_entry* aesd_circular_buffer_iter_next(
+		struct aesd_circular_buffer* buffer,
+		struct aesd_circular_buffer_iter* iter
+)
+{
+	if( iter->index >= aesd_circular_buffer_get_count( buffer ) ) {
+		return NULL;
+	}
+	return aesd_circular_buffer_entry_at( buffer, iter->index++ );
+}
+
+/**
+ * @return the start_offs of the oldest entry in @param buffer, which is also end_offs when it is empty.
+ */
+size_t aesd_circular_buffer_first_offset(
+		struct aesd_circular_buffer* buffer
+)
+{
+	return buffer->end_offs - buffer->total_size;
 }
 
 unsigned int aesd_circular_buffer_get_count(
@@ -57,12 +117,12 @@ unsigned int aesd_circular_buffer_get_count(
 			entry_count = buffer->in_offs - buffer->out_offs;
 		}
 		else {
-			entry_count = (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) - buffer->out_offs;
+			entry_count = (buffer->in_offs + buffer->capacity) - buffer->out_offs;
 		}
 	}
 	else {
 		// assert( buffer->out_offs == buffer->in_offs );
-		entry_count = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+		entry_count = buffer->capacity;
 	}
 	return entry_count;
 }
@@ -83,11 +143,17 @@ void aesd_circular_buffer_add_entry(
 	unsigned int entry_count = aesd_circular_buffer_get_count( buffer );
 	DEBUG_LOG( "count: %d\n", entry_count );
 	// 2. add element:
+	if( entry_count == buffer->capacity ) {
+		buffer->total_size -= buffer->entry[buffer->in_offs].size;
+	}
 	buffer->entry[buffer->in_offs] = (*add_entry);
-	buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+	buffer->entry[buffer->in_offs].start_offs = buffer->end_offs;
+	buffer->total_size += add_entry->size;
+	buffer->end_offs += add_entry->size;
+	buffer->in_offs = (buffer->in_offs + 1) % buffer->capacity;
 	// 3. handle corner cases:
-	if( entry_count < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ) {
-		if( entry_count+1 == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED ) {
+	if( entry_count < buffer->capacity ) {
+		if( entry_count+1 == buffer->capacity ) {
 			buffer->full = true;
 		}
 	}
@@ -96,10 +162,53 @@ void aesd_circular_buffer_add_entry(
 	}
 }
 
+/**
+* Removes the oldest entry of @param buffer and stores it in @param removed_entry.
+* Any necessary locking must be handled by the caller, the memory referenced by the entry is
+* handed back to the caller.
+* @return false if the buffer was empty.
+*/
+bool aesd_circular_buffer_remove_entry(
+		struct aesd_circular_buffer* buffer,
+		struct aesd_buffer_entry* removed_entry
+)
+{
+	if( aesd_circular_buffer_get_count( buffer ) == 0 ) {
+		return false;
+	}
+	(*removed_entry) = buffer->entry[buffer->out_offs];
+	buffer->entry[buffer->out_offs] = (struct aesd_buffer_entry){
+		.buffptr = NULL,
+		.size = 0,
+		.start_offs = 0,
+	};
+	buffer->total_size -= removed_entry->size;
+	buffer->out_offs = (buffer->out_offs + 1) % buffer->capacity;
+	buffer->full = false;
+	return true;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
+{
+    aesd_circular_buffer_init_storage(buffer,buffer->default_entry,AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+}
+
+/**
+* Initializes the circular buffer described by @param buffer to an empty struct
+* storing up to @param capacity entries in the caller owned array @param entries
+*/
+void aesd_circular_buffer_init_storage(
+		struct aesd_circular_buffer *buffer,
+		struct aesd_buffer_entry *entries,
+		unsigned int capacity
+)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    memset(entries,0,capacity*sizeof(struct aesd_buffer_entry));
+    buffer->entry = entries;
+    buffer->capacity = capacity;
 }
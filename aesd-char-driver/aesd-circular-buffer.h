@@ -24,18 +24,37 @@ struct aesd_buffer_entry
 	char *buffptr;
 	// Number of bytes stored in buffptr:
 	size_t size;
+	// Bytes added to the buffer before this entry, set by aesd_circular_buffer_add_entry():
+	size_t start_offs;
 };
 
 struct aesd_circular_buffer
 {
 	 // An array of pointers to memory allocated for the most recent write operations:
-	struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+	struct aesd_buffer_entry* entry;
+	// Number of slots in entry:
+	unsigned int capacity;
 	// The current location in the entry structure where the next write should be stored:
-	uint8_t in_offs;
+	unsigned int in_offs;
 	// The first location in the entry structure to read from:
-	uint8_t out_offs;
+	unsigned int out_offs;
 	// set to true when the buffer entry structure is full:
 	bool full;
+	// Sum of the sizes of all stored entries:
+	size_t total_size;
+	// Bytes ever added to the buffer, the start_offs of the next entry:
+	size_t end_offs;
+	// Slots used by aesd_circular_buffer_init():
+	struct aesd_buffer_entry default_entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+};
+
+/**
+ * Position of a sequential walk over the entries of a buffer, see aesd_circular_buffer_iter_seek().
+ */
+struct aesd_circular_buffer_iter
+{
+	// Index of the next entry, 0 being the oldest:
+	unsigned int index;
 };
 
 extern unsigned int aesd_circular_buffer_get_count(
@@ -48,23 +67,50 @@ extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos
 		size_t *entry_offset_byte_rtn
 );
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_iter_seek(
+		struct aesd_circular_buffer *buffer,
+		struct aesd_circular_buffer_iter *iter,
+		size_t char_offset,
+		size_t *entry_offset_byte_rtn
+);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_iter_next(
+		struct aesd_circular_buffer *buffer,
+		struct aesd_circular_buffer_iter *iter
+);
+
+extern size_t aesd_circular_buffer_first_offset(
+		struct aesd_circular_buffer *buffer
+);
+
 extern void aesd_circular_buffer_add_entry(
 		struct aesd_circular_buffer *buffer,
 		const struct aesd_buffer_entry *add_entry
 );
 
+extern bool aesd_circular_buffer_remove_entry(
+		struct aesd_circular_buffer *buffer,
+		struct aesd_buffer_entry *removed_entry
+);
+
 extern void aesd_circular_buffer_init(
 		struct aesd_circular_buffer *buffer
 );
 
+extern void aesd_circular_buffer_init_storage(
+		struct aesd_circular_buffer *buffer,
+		struct aesd_buffer_entry *entries,
+		unsigned int capacity
+);
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is an unsigned int stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * unsigned int index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,7 +120,7 @@ extern void aesd_circular_buffer_init(
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
 	for( \
 			index=0, entryptr=&((buffer)->entry[index]); \
-      index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+      index<(buffer)->capacity; \
 			index++, entryptr=&((buffer)->entry[index]) \
 	)
 
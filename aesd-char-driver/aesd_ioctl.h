@@ -0,0 +1,60 @@
+/*
+ * aesd_ioctl.h
+ *
+ * ioctl interface of the aesdchar device, shared with user space.
+ */
+
+#ifndef AESD_IOCTL_H
+#define AESD_IOCTL_H
+
+#ifdef __KERNEL__
+#include <asm-generic/ioctl.h>
+#include <linux/types.h>
+#else
+#include <sys/ioctl.h>
+#include <stdint.h>
+#endif
+
+/**
+ * History retained by the device ring.
+ */
+struct aesd_ring_config
+{
+	// Maximum number of entries, 1 to AESDCHAR_MAX_RING_ENTRIES:
+	uint64_t entries;
+	// Maximum number of bytes held by all entries, 0 for no limit. The newest entry is always kept:
+	uint64_t bytes;
+};
+
+#define AESDCHAR_MAX_RING_ENTRIES (1U << 20)
+
+/**
+ * First page of a read-only mmap() of the device, the data area follows one page size into
+ * the mapping. Offsets count the bytes ever committed to the ring, the byte at
+ * offset x is stored at data[x % data_size]. The bytes in [max(tail, head - data_size), head)
+ * are valid; if head - tail exceeds data_size the oldest entries are only available to read().
+ * A reader samples an even generation, copies or parses what it needs and accepts the result
+ * if generation is unchanged afterwards, or if its range is still at or above the new window.
+ */
+struct aesd_mmap_header
+{
+	// Incremented before and after every update, odd while one is in progress:
+	uint64_t generation;
+	// Offset following the newest committed byte:
+	uint64_t head;
+	// Offset of the oldest byte of the oldest entry in the ring:
+	uint64_t tail;
+	// Size of the data area, a power of two multiple of the page size:
+	uint64_t data_size;
+};
+
+// Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
+#define AESD_IOC_MAGIC 0x16
+
+// Number 1 is left for AESDCHAR_IOCSEEKTO
+// Fails with EBADF unless the descriptor is open for writing or the caller has CAP_SYS_ADMIN:
+#define AESDCHAR_IOCSETRING _IOW(AESD_IOC_MAGIC, 2, struct aesd_ring_config)
+#define AESDCHAR_IOCGETRING _IOR(AESD_IOC_MAGIC, 3, struct aesd_ring_config)
+#define AESDCHAR_IOC_MAXNR 3
+
+#endif /* AESD_IOCTL_H */
@@ -26,14 +26,46 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Allocation behind every aesd_buffer_entry buffptr, which points at data.
+ * The ring holds one reference, readers pin the record while they copy from it.
+ */
+struct aesd_record
+{
+	struct kref ref;
+	struct rcu_head rcu;
+	char data[];
+};
+
+/**
+ * Per-open state in filp->private_data. Writes are staged here until they end in a newline
+ * and are committed to the ring as one entry.
+ */
+struct aesd_file
+{
+	struct aesd_buffer_entry staged;
+	// only contended by threads writing through the same open file:
+	struct mutex lock;
+};
+
 struct aesd_dev
 {
 	/**
 	 * structure(s) and locks needed to complete assignment requirements
 	 */
-	struct aesd_circular_buffer buffer;
+	// replaced as a whole when the capacity changes:
+	struct aesd_circular_buffer __rcu* buffer;
+	// byte budget of the ring, 0 for no limit:
+	size_t max_bytes;
+	// partial write left behind by a closed file, adopted by the next open:
 	struct aesd_buffer_entry current_entry;
+	// serializes ring commits:
 	struct mutex lock;
+	// lets readers detect a ring update racing their lookup:
+	seqcount_mutex_t seq;
+	// header page and data area mirroring the committed bytes for mmap(), see aesd_ioctl.h:
+	void* mmap_area;
+	size_t mmap_data_size;
 
 	struct cdev cdev;     /* Char device structure      */
 };
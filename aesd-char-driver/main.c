@@ -4,18 +4,28 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/uio.h> // iov_iter
+#include <linux/slab.h> // krealloc
+#include <linux/kref.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+#include <linux/mm.h> // kvcalloc, remap_vmalloc_range
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/moduleparam.h>
+#include <linux/version.h>
+#include <linux/capability.h>
 #include "aesdchar.h"
+#include "aesd_ioctl.h"
 
 MODULE_AUTHOR("Ricardo Alvarez");
 MODULE_LICENSE("Dual BSD/GPL");
 
 int aesd_open(struct inode *inode, struct file *filp);
 int aesd_release(struct inode *inode, struct file *filp);
-ssize_t aesd_read(
-	struct file *filp,
-	char __user *buf,
-	size_t count,
-	loff_t *f_pos
+ssize_t aesd_read_iter(
+	struct kiocb *iocb,
+	struct iov_iter *to
 );
 ssize_t aesd_write(
 		struct file *filp,
@@ -23,6 +33,20 @@ ssize_t aesd_write(
 		size_t count,
 		loff_t *f_pos
 );
+loff_t aesd_llseek(
+		struct file *filp,
+		loff_t off,
+		int whence
+);
+long aesd_unlocked_ioctl(
+		struct file *filp,
+		unsigned int cmd,
+		unsigned long arg
+);
+int aesd_mmap(
+		struct file *filp,
+		struct vm_area_struct *vma
+);
 static int aesd_setup_cdev(struct aesd_dev *dev);
 int aesd_init_module(void);
 void aesd_cleanup_module(void);
@@ -30,82 +54,322 @@ void aesd_cleanup_module(void);
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+static unsigned int aesd_ring_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param_named( ring_entries, aesd_ring_entries, uint, 0444 );
+MODULE_PARM_DESC( ring_entries, "Initial number of writes kept by the ring, AESDCHAR_IOCSETRING changes it at runtime" );
+static unsigned long aesd_ring_bytes = 0;
+module_param_named( ring_bytes, aesd_ring_bytes, ulong, 0444 );
+MODULE_PARM_DESC( ring_bytes, "Initial byte budget of the ring, 0 for no limit" );
+static unsigned long aesd_mmap_bytes = 1024 * 1024;
+module_param_named( mmap_bytes, aesd_mmap_bytes, ulong, 0444 );
+MODULE_PARM_DESC( mmap_bytes, "Size of the mmap() data area, rounded up to a power of two pages" );
+
 struct aesd_dev aesd_device;
 
 struct file_operations aesd_fops = {
 	.owner =    THIS_MODULE,
-	.read =     aesd_read,
+	.read_iter = aesd_read_iter,
+	// splice() support lets aesdsocket echo the history device -> pipe -> socket:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
 	.write =    aesd_write,
+	.llseek =   aesd_llseek,
+	.unlocked_ioctl = aesd_unlocked_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.mmap =     aesd_mmap,
 	.open =     aesd_open,
 	.release =  aesd_release,
 };
 
+static struct aesd_record* aesd_record_of( const char* buffptr )
+{
+	return container_of( buffptr, struct aesd_record, data[0] );
+}
+
+static void aesd_record_release( struct kref* ref )
+{
+	struct aesd_record* record = container_of( ref, struct aesd_record, ref );
+	// readers may still be looking at the record inside their rcu read section:
+	kfree_rcu( record, rcu );
+}
+
+static void aesd_record_put( struct aesd_record* record )
+{
+	kref_put( &record->ref, aesd_record_release );
+}
+
+static struct aesd_circular_buffer* aesd_alloc_buffer( unsigned int capacity )
+{
+	struct aesd_circular_buffer* buffer = kmalloc( sizeof( *buffer ), GFP_KERNEL );
+	struct aesd_buffer_entry* entries = kvcalloc( capacity, sizeof( *entries ), GFP_KERNEL );
+	if( !buffer || !entries ) {
+		kfree( buffer );
+		kvfree( entries );
+		return NULL;
+	}
+	aesd_circular_buffer_init_storage( buffer, entries, capacity );
+	return buffer;
+}
+
+/**
+ * Frees the ring itself, the records it references must have been released already.
+ */
+static void aesd_free_buffer( struct aesd_circular_buffer* buffer )
+{
+	kvfree( buffer->entry );
+	kfree( buffer );
+}
+
+/**
+ * Drops the oldest entries of @param buffer until it has room for one more entry of
+ * @param size bytes within the byte budget, keeping at least the new entry.
+ * Must be called inside a write_seqcount section of aesd_device.seq.
+ */
+static void aesd_evict_entries( struct aesd_circular_buffer* buffer, size_t size )
+{
+	struct aesd_buffer_entry removed;
+	while(
+			aesd_circular_buffer_get_count( buffer ) == buffer->capacity ||
+			(
+					aesd_device.max_bytes != 0 &&
+					aesd_circular_buffer_get_count( buffer ) > 0 &&
+					buffer->total_size + size > aesd_device.max_bytes
+			)
+	) {
+		aesd_circular_buffer_remove_entry( buffer, &removed );
+		// the slot no longer points at the record, pinned readers keep it alive:
+		aesd_record_put( aesd_record_of( removed.buffptr ) );
+	}
+}
+
+/**
+ * Starts an update of the mmap() header, readers seeing an odd generation retry.
+ * Must be called with aesd_device.lock held.
+ */
+static void aesd_mmap_begin( void )
+{
+	struct aesd_mmap_header* header = aesd_device.mmap_area;
+	WRITE_ONCE( header->generation, header->generation + 1 );
+	smp_wmb();
+}
+
+/**
+ * Mirrors @param size bytes committed at offset @param start_offs into the mmap() data area.
+ */
+static void aesd_mmap_copy( size_t start_offs, const char* data, size_t size )
+{
+	char* area = (char*)aesd_device.mmap_area + PAGE_SIZE;
+	size_t mask = aesd_device.mmap_data_size - 1;
+	// only the newest data_size bytes survive anyway:
+	if( size > aesd_device.mmap_data_size ) {
+		start_offs += size - aesd_device.mmap_data_size;
+		data += size - aesd_device.mmap_data_size;
+		size = aesd_device.mmap_data_size;
+	}
+	while( size > 0 ) {
+		size_t chunk = min( size, aesd_device.mmap_data_size - (start_offs & mask) );
+		memcpy( &area[start_offs & mask], data, chunk );
+		start_offs += chunk;
+		data += chunk;
+		size -= chunk;
+	}
+}
+
+static void aesd_mmap_end( struct aesd_circular_buffer* buffer )
+{
+	struct aesd_mmap_header* header = aesd_device.mmap_area;
+	WRITE_ONCE( header->head, buffer->end_offs );
+	WRITE_ONCE( header->tail, aesd_circular_buffer_first_offset( buffer ) );
+	smp_wmb();
+	WRITE_ONCE( header->generation, header->generation + 1 );
+}
+
+/**
+ * Progress of one read through the ring. After the first record the walk continues from the
+ * stream offset the previous record ended at, so writers rotating the ring meanwhile make it
+ * neither repeat nor skip records that are still stored.
+ */
+struct aesd_read_cursor
+{
+	struct aesd_circular_buffer_iter iter;
+	// start_offs expected for the next record, once started is set:
+	size_t next_start;
+	bool started;
+};
+
+/**
+ * Looks up the next committed record of a read without taking aesd_device.lock: the record
+ * holding byte @param pos first, then the records following it. The lookup is retried until it
+ * did not race with a writer, the record is pinned by a reference so it survives eviction while
+ * the caller copies from it.
+ * @return the record, to be released with aesd_record_put(), or NULL past the end of the ring.
+ */
+static struct aesd_record* aesd_get_record(
+	size_t pos,
+	struct aesd_read_cursor* cursor,
+	size_t* offset,
+	size_t* size
+)
+{
+	struct aesd_record* record = NULL;
+	struct aesd_circular_buffer_iter iter;
+	size_t start = 0;
+	unsigned int seq;
+	rcu_read_lock();
+	do {
+		struct aesd_circular_buffer* buffer;
+		struct aesd_buffer_entry* entry;
+		char* buffptr;
+		if( record ) {
+			aesd_record_put( record );
+			record = NULL;
+		}
+		seq = read_seqcount_begin( &aesd_device.seq );
+		buffer = rcu_dereference( aesd_device.buffer );
+		iter = cursor->iter;
+		if( !cursor->started ) {
+			entry = aesd_circular_buffer_iter_seek( buffer, &iter, pos, offset );
+		}
+		else {
+			// usually the next entry, unless writers rotated or replaced the ring since:
+			entry = aesd_circular_buffer_iter_next( buffer, &iter );
+			*offset = 0;
+			if( !entry || READ_ONCE( entry->start_offs ) != cursor->next_start ) {
+				size_t char_offset = cursor->next_start - aesd_circular_buffer_first_offset( buffer );
+				// the records following the previous one were evicted, go on with the oldest:
+				if( char_offset > buffer->total_size ) {
+					char_offset = 0;
+				}
+				entry = aesd_circular_buffer_iter_seek( buffer, &iter, char_offset, offset );
+			}
+		}
+		if( !entry ) {
+			continue;
+		}
+		buffptr = READ_ONCE( entry->buffptr );
+		*size = READ_ONCE( entry->size );
+		start = READ_ONCE( entry->start_offs );
+		// a torn entry is caught by the retry, just never follow a NULL pointer:
+		if( buffptr && kref_get_unless_zero( &aesd_record_of( buffptr )->ref ) ) {
+			record = aesd_record_of( buffptr );
+		}
+	}
+	while( read_seqcount_retry( &aesd_device.seq, seq ) );
+	rcu_read_unlock();
+	if( record ) {
+		cursor->iter = iter;
+		cursor->next_start = start + *size;
+		cursor->started = true;
+	}
+	return record;
+}
+
 int aesd_open(struct inode *inode, struct file *filp)
 {
+	struct aesd_file* file;
 	PDEBUG("open");
-	/**
-	 * TODO: handle open
-	 */
+	file = kzalloc( sizeof( *file ), GFP_KERNEL );
+	if( !file ) {
+		return -ENOMEM;
+	}
+	mutex_init( &file->lock );
+	// continue a partial write left behind by a closed file, e.g. "echo -n" followed by "echo":
+	if( filp->f_mode & FMODE_WRITE ) {
+		mutex_lock( &aesd_device.lock );
+		file->staged = aesd_device.current_entry;
+		aesd_device.current_entry = (struct aesd_buffer_entry){
+			.buffptr = NULL,
+			.size = 0,
+		};
+		mutex_unlock( &aesd_device.lock );
+	}
+	filp->private_data = file;
 	return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
+	struct aesd_file* file = filp->private_data;
 	PDEBUG("release");
-	/**
-	 * TODO: handle release
-	 */
+	// hand a partial write over to the next open:
+	if( file->staged.buffptr != NULL ) {
+		struct aesd_record* record = NULL;
+		size_t insert_pos = 0;
+		mutex_lock( &aesd_device.lock );
+		if( aesd_device.current_entry.buffptr != NULL ) {
+			record = aesd_record_of( aesd_device.current_entry.buffptr );
+			insert_pos = aesd_device.current_entry.size;
+		}
+		record = krealloc(
+				record,
+				struct_size( record, data, insert_pos + file->staged.size ),
+				GFP_KERNEL
+		);
+		if( record != NULL ) {
+			memcpy( &record->data[insert_pos], file->staged.buffptr, file->staged.size );
+			aesd_device.current_entry.buffptr = record->data;
+			aesd_device.current_entry.size = insert_pos + file->staged.size;
+		}
+		mutex_unlock( &aesd_device.lock );
+		kfree( aesd_record_of( file->staged.buffptr ) );
+	}
+	mutex_destroy( &file->lock );
+	kfree( file );
 	return 0;
 }
 
-ssize_t aesd_read(
-	struct file* filp,
-	char __user* buf,
-	size_t count,
-	loff_t* f_pos
+ssize_t aesd_read_iter(
+	struct kiocb* iocb,
+	struct iov_iter* to
 )
 {
-	size_t pos = *f_pos;
+	size_t pos = iocb->ki_pos;
+	struct aesd_read_cursor cursor = {
+		.started = false,
+	};
 	ssize_t ret = 0;
-	mutex_lock( &aesd_device.lock );
-	PDEBUG("read %zu bytes with offset %lld\n",count,*f_pos);
-	while( true )
+	// readers never take aesd_device.lock, faulting on a user page only stalls this reader:
+	PDEBUG("read %zu bytes with offset %lld\n",iov_iter_count(to),iocb->ki_pos);
+	while( iov_iter_count( to ) > 0 )
 	{
 		size_t bytes_to_copy;
+		size_t bytes_copied;
 		size_t offset = 0;
-		struct aesd_buffer_entry* entry = aesd_circular_buffer_find_entry_offset_for_fpos(
-				&aesd_device.buffer,
+		size_t size = 0;
+		struct aesd_record* record = aesd_get_record(
 				pos,
-				&offset
+				&cursor,
+				&offset,
+				&size
 		);
-		if( !entry ) {
-			ret = pos - (*f_pos);
-			(*f_pos) += ret;
-			goto end;
-		}
-		bytes_to_copy = ((*f_pos)+count) - pos;
-		if( bytes_to_copy == 0 ) {
-			ret = pos - (*f_pos);
-			(*f_pos) += ret;
-			goto end;
+		if( !record ) {
+			break;
 		}
-		if( bytes_to_copy > (entry->size - offset) ) {
-			bytes_to_copy = entry->size - offset;
-		}
-		if( copy_to_user(
-				&buf[pos],
-				&entry->buffptr[offset],
-				bytes_to_copy
-		) ) {
-			ret = -EFAULT;
-			goto end;
+		bytes_to_copy = min( iov_iter_count( to ), size - offset );
+		// works for user buffers (read) as well as pipe pages (splice):
+		bytes_copied = copy_to_iter(
+				&record->data[offset],
+				bytes_to_copy,
+				to
+		);
+		aesd_record_put( record );
+		pos += bytes_copied;
+		if( bytes_copied != bytes_to_copy ) {
+			if( pos == iocb->ki_pos ) {
+				ret = -EFAULT;
+				goto end;
+			}
+			break;
 		}
-		pos += bytes_to_copy;
 	}
+	ret = pos - iocb->ki_pos;
+	iocb->ki_pos = pos;
 
 end:
 	PDEBUG("returning: %ld", ret );
-	mutex_unlock( &aesd_device.lock );
 	return ret;
 }
 
@@ -117,64 +381,178 @@ ssize_t aesd_write(
 		loff_t *f_pos
 )
 {
+	struct aesd_file* file = filp->private_data;
 	size_t insert_pos = 0;
-	mutex_lock( &aesd_device.lock );
+	struct aesd_record* record = NULL;
+	// partial writes are staged per open file, writers only share the commit step:
+	mutex_lock( &file->lock );
 		PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
 	if( count == 0 ) {
-		mutex_unlock( &aesd_device.lock );
+		mutex_unlock( &file->lock );
 		return 0;
 	}
-	// allocate/reallocate buffer entry:
-		if( aesd_device.current_entry.buffptr == NULL ) {
-
-		aesd_device.current_entry.buffptr = kmalloc(count, GFP_KERNEL );
-		aesd_device.current_entry.size = count;
+	// allocate/reallocate the staged record:
+	if( file->staged.buffptr != NULL ) {
+		record = aesd_record_of( file->staged.buffptr );
+		insert_pos = file->staged.size;
 	}
-	else {
-		insert_pos = aesd_device.current_entry.size;
-		aesd_device.current_entry.buffptr = krealloc(
-				aesd_device.current_entry.buffptr,
-				aesd_device.current_entry.size + count,
-				GFP_KERNEL
-		);
-		aesd_device.current_entry.size += count;
-	}
-	if( aesd_device.current_entry.buffptr == NULL ) {
-		mutex_unlock( &aesd_device.lock );
+	record = krealloc(
+			record,
+			struct_size( record, data, insert_pos + count ),
+			GFP_KERNEL
+	);
+	if( record == NULL ) {
+		mutex_unlock( &file->lock );
 		return -ENOMEM;
 	}
-	// copy to buffer entry:
+	file->staged.buffptr = record->data;
+	// copy to the staged record:
 	if( copy_from_user(
-			&aesd_device.current_entry.buffptr[insert_pos],
+			&record->data[insert_pos],
 			buf,
 			count
 	) ) {
-		mutex_unlock( &aesd_device.lock );
+		mutex_unlock( &file->lock );
 		return -EFAULT;
 	}
-	// copy entry to ringbuffer:
-	if( buf[count-1] == '\n' ) {
-		if(
-				aesd_circular_buffer_get_count( &aesd_device.buffer ) == AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
-		) {
-			struct aesd_buffer_entry* last_entry = &aesd_device.buffer.entry[ aesd_device.buffer.in_offs];
-			kfree( last_entry->buffptr );
-			last_entry->buffptr = NULL;
-			last_entry->size = 0;
-		}
+	file->staged.size = insert_pos + count;
+	// commit the record to the ringbuffer:
+	if( record->data[insert_pos + count - 1] == '\n' ) {
+		struct aesd_circular_buffer* buffer;
+		kref_init( &record->ref );
+		mutex_lock( &aesd_device.lock );
+		buffer = rcu_dereference_protected( aesd_device.buffer, lockdep_is_held( &aesd_device.lock ) );
+		write_seqcount_begin( &aesd_device.seq );
+		aesd_mmap_begin();
+		aesd_evict_entries( buffer, file->staged.size );
+		aesd_mmap_copy( buffer->end_offs, record->data, file->staged.size );
 		aesd_circular_buffer_add_entry(
-				&aesd_device.buffer,
-				&aesd_device.current_entry
+				buffer,
+				&file->staged
 		);
-		aesd_device.current_entry = (struct aesd_buffer_entry){
+		aesd_mmap_end( buffer );
+		write_seqcount_end( &aesd_device.seq );
+		mutex_unlock( &aesd_device.lock );
+		file->staged = (struct aesd_buffer_entry){
 			.buffptr = NULL,
 			.size = 0,
 		};
 	}
-	mutex_unlock( &aesd_device.lock );
+	mutex_unlock( &file->lock );
 	return count;
 }
 
+/**
+ * Replaces the ring with one holding @param config->entries slots, keeping the newest entries
+ * that fit the new capacity and byte budget. Readers still walking the old ring are waited for
+ * before it is freed.
+ */
+static long aesd_set_ring( const struct aesd_ring_config* config )
+{
+	struct aesd_circular_buffer* old_buffer;
+	struct aesd_circular_buffer* new_buffer;
+	struct aesd_buffer_entry moved;
+	if( config->entries == 0 || config->entries > AESDCHAR_MAX_RING_ENTRIES ) {
+		return -EINVAL;
+	}
+	new_buffer = aesd_alloc_buffer( config->entries );
+	if( !new_buffer ) {
+		return -ENOMEM;
+	}
+	mutex_lock( &aesd_device.lock );
+	old_buffer = rcu_dereference_protected( aesd_device.buffer, lockdep_is_held( &aesd_device.lock ) );
+	write_seqcount_begin( &aesd_device.seq );
+	aesd_mmap_begin();
+	aesd_device.max_bytes = config->bytes;
+	// moved entries keep their start_offs, running reads continue in the new ring:
+	new_buffer->end_offs = aesd_circular_buffer_first_offset( old_buffer );
+	while( aesd_circular_buffer_remove_entry( old_buffer, &moved ) ) {
+		aesd_evict_entries( new_buffer, moved.size );
+		aesd_circular_buffer_add_entry( new_buffer, &moved );
+	}
+	rcu_assign_pointer( aesd_device.buffer, new_buffer );
+	aesd_mmap_end( new_buffer );
+	write_seqcount_end( &aesd_device.seq );
+	mutex_unlock( &aesd_device.lock );
+	synchronize_rcu();
+	aesd_free_buffer( old_buffer );
+	return 0;
+}
+
+loff_t aesd_llseek(
+		struct file *filp,
+		loff_t off,
+		int whence
+)
+{
+	loff_t size;
+	// SEEK_END sees the ring as of this call, writers may rotate it right after:
+	rcu_read_lock();
+	size = READ_ONCE( rcu_dereference( aesd_device.buffer )->total_size );
+	rcu_read_unlock();
+	PDEBUG("llseek %lld whence %d, size %lld", off, whence, size);
+	return fixed_size_llseek( filp, off, whence, size );
+}
+
+long aesd_unlocked_ioctl(
+		struct file *filp,
+		unsigned int cmd,
+		unsigned long arg
+)
+{
+	struct aesd_ring_config config;
+	if( _IOC_TYPE( cmd ) != AESD_IOC_MAGIC || _IOC_NR( cmd ) > AESDCHAR_IOC_MAXNR ) {
+		return -ENOTTY;
+	}
+	switch( cmd ) {
+		case AESDCHAR_IOCSETRING:
+			// resizing drops history other openers rely on, so it takes a writable descriptor:
+			if( !( filp->f_mode & FMODE_WRITE ) && !capable( CAP_SYS_ADMIN ) ) {
+				return -EBADF;
+			}
+			if( copy_from_user( &config, (const void __user*)arg, sizeof( config ) ) ) {
+				return -EFAULT;
+			}
+			PDEBUG("set ring: %llu entries, %llu bytes", config.entries, config.bytes);
+			return aesd_set_ring( &config );
+		case AESDCHAR_IOCGETRING:
+			mutex_lock( &aesd_device.lock );
+			config = (struct aesd_ring_config){
+				.entries = rcu_dereference_protected( aesd_device.buffer, lockdep_is_held( &aesd_device.lock ) )->capacity,
+				.bytes = aesd_device.max_bytes,
+			};
+			mutex_unlock( &aesd_device.lock );
+			if( copy_to_user( (void __user*)arg, &config, sizeof( config ) ) ) {
+				return -EFAULT;
+			}
+			return 0;
+		default:
+			return -ENOTTY;
+	}
+}
+
+/**
+ * Maps the header page and the data area read-only, mappings of any length starting at any
+ * page within the area are accepted.
+ */
+int aesd_mmap(
+		struct file *filp,
+		struct vm_area_struct *vma
+)
+{
+	PDEBUG("mmap %lu bytes at page %lu", vma->vm_end - vma->vm_start, vma->vm_pgoff);
+	// history is published read-only, writes go through write():
+	if( vma->vm_flags & VM_WRITE ) {
+		return -EPERM;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear( vma, VM_MAYWRITE );
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+	return remap_vmalloc_range( vma, aesd_device.mmap_area, vma->vm_pgoff );
+}
+
 static int aesd_setup_cdev(struct aesd_dev *dev)
 {
 	int err, devno = MKDEV(aesd_major, aesd_minor);
@@ -206,10 +584,30 @@ int aesd_init_module(void)
 	memset(&aesd_device,0,sizeof(struct aesd_dev));
 
 	mutex_init( &aesd_device.lock );
+	seqcount_mutex_init( &aesd_device.seq, &aesd_device.lock );
 	/**
 	 * initialize the AESD specific portion of the device
 	 */
-	aesd_circular_buffer_init( &aesd_device.buffer );
+	if( aesd_ring_entries == 0 || aesd_ring_entries > AESDCHAR_MAX_RING_ENTRIES ) {
+		printk(KERN_WARNING "Invalid ring_entries %u\n", aesd_ring_entries);
+		unregister_chrdev_region(dev, 1);
+		return -EINVAL;
+	}
+	aesd_device.max_bytes = aesd_ring_bytes;
+	RCU_INIT_POINTER( aesd_device.buffer, aesd_alloc_buffer( aesd_ring_entries ) );
+	if( !rcu_access_pointer( aesd_device.buffer ) ) {
+		unregister_chrdev_region(dev, 1);
+		return -ENOMEM;
+	}
+	aesd_device.mmap_data_size = roundup_pow_of_two( max( aesd_mmap_bytes, PAGE_SIZE ) );
+	// vmalloc_user() memory is zeroed and may be remapped to user space:
+	aesd_device.mmap_area = vmalloc_user( PAGE_SIZE + aesd_device.mmap_data_size );
+	if( !aesd_device.mmap_area ) {
+		aesd_free_buffer( rcu_access_pointer( aesd_device.buffer ) );
+		unregister_chrdev_region(dev, 1);
+		return -ENOMEM;
+	}
+	((struct aesd_mmap_header*)aesd_device.mmap_area)->data_size = aesd_device.mmap_data_size;
 	aesd_device.current_entry = (struct aesd_buffer_entry ){
 		.buffptr = NULL,
 		.size = 0,
@@ -218,6 +616,8 @@ int aesd_init_module(void)
 	result = aesd_setup_cdev(&aesd_device);
 
 	if( result ) {
+		vfree( aesd_device.mmap_area );
+		aesd_free_buffer( rcu_access_pointer( aesd_device.buffer ) );
 		unregister_chrdev_region(dev, 1);
 	}
 	return result;
@@ -226,22 +626,23 @@ int aesd_init_module(void)
 void aesd_cleanup_module(void)
 {
 	dev_t devno = MKDEV(aesd_major, aesd_minor);
+	struct aesd_circular_buffer* buffer = rcu_access_pointer( aesd_device.buffer );
+	struct aesd_buffer_entry removed;
+
+	cdev_del(&aesd_device.cdev);
 
 	// cleanup write buffer:
 	if( aesd_device.current_entry.buffptr != NULL ) {
-		kfree( aesd_device.current_entry.buffptr );
+		kfree( aesd_record_of( aesd_device.current_entry.buffptr ) );
 	}
 	// cleanup ring buffer:
-	for( uint8_t i=0; i<aesd_circular_buffer_get_count( &aesd_device.buffer ); i++ ) {
-		struct aesd_buffer_entry* entry = &aesd_device.buffer.entry[
-			aesd_device.buffer.out_offs + i
-		];
-		kfree( entry->buffptr );
-		entry->buffptr = NULL;
-		entry->size = 0;
+	while( aesd_circular_buffer_remove_entry( buffer, &removed ) ) {
+		aesd_record_put( aesd_record_of( removed.buffptr ) );
 	}
-
-	cdev_del(&aesd_device.cdev);
+	aesd_free_buffer( buffer );
+	vfree( aesd_device.mmap_area );
+	// wait for the deferred frees of evicted records:
+	rcu_barrier();
 
 	/**
 	 * TODO: cleanup AESD specific poritions here as necessary
@@ -0,0 +1,426 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+
+#define MIN_LINE_SIZE 24
+
+#define RETRY_ON_INTERRUPT(expression)                  \
+({                                                      \
+    int RETRY_ON_INTERRUPT_result = 0;                  \
+    while (true)                                        \
+    {                                                   \
+        RETRY_ON_INTERRUPT_result = (expression);   \
+        if (RETRY_ON_INTERRUPT_result == -1)            \
+        {                                               \
+            if (errno == EINTR)                         \
+                continue;                               \
+            else                                        \
+                break;                                  \
+        }                                               \
+        else                                            \
+        {                                               \
+            break;                                      \
+        }                                               \
+    }                                                   \
+    RETRY_ON_INTERRUPT_result;                          \
+})
+
+struct Connection
+{
+    size_t index;
+    pthread_t threadId;
+    int socket;
+    // One latency sample per line, in nanoseconds:
+    uint64_t* latencies;
+    size_t latencyCount;
+    uint64_t echoBytes;
+    size_t errorCount;
+    char* echoBuffer;
+    size_t echoBufferSize;
+};
+
+static size_t g_connectionCount = 8;
+static size_t g_lineCount = 100;
+static size_t g_lineSize = 64;
+static size_t g_lineRate = 0;
+static uint16_t g_port = 9000;
+static pthread_barrier_t g_startBarrier;
+
+uint64_t MonotonicClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+void SleepUntil(uint64_t deadline)
+{
+    struct timespec wakeup = {
+        .tv_sec = deadline / 1000000000,
+        .tv_nsec = deadline % 1000000000,
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL) == EINTR)
+        ;
+}
+
+/**
+ * Fills @param line with a record unique to the connection and sequence number, so the echo is
+ * known to be complete once it ends with this record.
+ */
+void FormatLine(char* line, size_t connectionIndex, size_t sequence)
+{
+    int tagSize = snprintf(line, g_lineSize, "c%06zu-s%09zu-", connectionIndex, sequence);
+    memset(&line[tagSize], 'x', g_lineSize - 1 - tagSize);
+    line[g_lineSize - 1] = '\n';
+}
+
+bool SendAll(int socket, const char* buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t sentBytes = RETRY_ON_INTERRUPT(send(socket, buffer, size, MSG_NOSIGNAL));
+        if (sentBytes == -1)
+            return false;
+        buffer += sentBytes;
+        size -= sentBytes;
+    }
+    return true;
+}
+
+/**
+ * Receives until the history echo ends with @param line.
+ * @return the echo size, or 0 if the connection failed.
+ */
+size_t ReceiveEcho(struct Connection* connection, const char* line)
+{
+    size_t echoSize = 0;
+    while (echoSize < g_lineSize || memcmp(&connection->echoBuffer[echoSize - g_lineSize], line, g_lineSize) != 0)
+    {
+        if (echoSize == connection->echoBufferSize)
+        {
+            size_t newSize = connection->echoBufferSize * 2;
+            char* newBuffer = realloc(connection->echoBuffer, newSize);
+            if (newBuffer == NULL)
+            {
+                fprintf(stderr, "Cannot allocate echo memory.\n");
+                return 0;
+            }
+            connection->echoBuffer = newBuffer;
+            connection->echoBufferSize = newSize;
+        }
+
+        ssize_t recvBytes = RETRY_ON_INTERRUPT(recv(connection->socket, &connection->echoBuffer[echoSize], connection->echoBufferSize - echoSize, 0));
+        if (recvBytes <= 0)
+        {
+            fprintf(stderr, "Connection %zu: %s while waiting for the echo.\n", connection->index, recvBytes == 0 ? "closed" : strerror(errno));
+            return 0;
+        }
+        echoSize += recvBytes;
+    }
+
+    return echoSize;
+}
+
+/**
+ * Every echo is a snapshot of the history, so it is made of whole records and the newest one
+ * must be the line this connection just sent.
+ */
+bool CheckEcho(const struct Connection* connection, size_t echoSize)
+{
+    if (echoSize % g_lineSize != 0)
+        return false;
+
+    for (size_t offset = g_lineSize - 1; offset < echoSize; offset += g_lineSize)
+    {
+        if (connection->echoBuffer[offset] != '\n' || connection->echoBuffer[offset - g_lineSize + 1] != 'c')
+            return false;
+    }
+    return true;
+}
+
+void* ConnectionLoop(void* argument)
+{
+    struct Connection* connection = (struct Connection*)argument;
+    char* line = malloc(g_lineSize);
+    if (line == NULL)
+    {
+        fprintf(stderr, "Cannot allocate line memory.\n");
+        connection->errorCount++;
+        pthread_barrier_wait(&g_startBarrier);
+        return NULL;
+    }
+
+    pthread_barrier_wait(&g_startBarrier);
+
+    uint64_t interval = g_lineRate != 0 ? 1000000000 / g_lineRate : 0;
+    uint64_t nextSend = MonotonicClock();
+    for (size_t i = 0; i < g_lineCount; i++)
+    {
+        FormatLine(line, connection->index, i);
+
+        if (interval != 0)
+            SleepUntil(nextSend);
+
+        // Open loop runs are timed from the schedule, a stalled server cannot hide its backlog.
+        uint64_t startTime = interval != 0 ? nextSend : MonotonicClock();
+        nextSend += interval;
+
+        if (!SendAll(connection->socket, line, g_lineSize))
+        {
+            fprintf(stderr, "Connection %zu: %s while sending.\n", connection->index, strerror(errno));
+            connection->errorCount++;
+            break;
+        }
+
+        size_t echoSize = ReceiveEcho(connection, line);
+        if (echoSize == 0)
+        {
+            connection->errorCount++;
+            break;
+        }
+
+        connection->latencies[connection->latencyCount++] = MonotonicClock() - startTime;
+        connection->echoBytes += echoSize;
+
+        if (!CheckEcho(connection, echoSize))
+        {
+            fprintf(stderr, "Connection %zu: malformed echo after line %zu.\n", connection->index, i);
+            connection->errorCount++;
+        }
+    }
+
+    free(line);
+    return NULL;
+}
+
+int CompareLatencies(const void* first, const void* second)
+{
+    uint64_t firstLatency = *(const uint64_t*)first;
+    uint64_t secondLatency = *(const uint64_t*)second;
+    return firstLatency < secondLatency ? -1 : firstLatency > secondLatency;
+}
+
+double Percentile(const uint64_t* latencies, size_t count, double percentile)
+{
+    size_t index = (size_t)(percentile * (double)(count - 1) + 0.5);
+    return (double)latencies[index] / 1000.0;
+}
+
+int ConnectServer()
+{
+    int clientSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (clientSocket == -1)
+        return -1;
+
+    int noDelay = 1;
+    setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(g_port);
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (RETRY_ON_INTERRUPT(connect(clientSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress))) == -1)
+    {
+        close(clientSocket);
+        return -1;
+    }
+
+    return clientSocket;
+}
+
+void PrintHelp()
+{
+    printf(
+        "aesdbench - Load Generator for aesdsocket\n"
+        "---------------------------------------\n"
+        "Usage: aesdbench [-c connections] [-n lines] [-s size] [-r rate] [-p port]\n"
+        "\n"
+        "Every connection sends a line, waits for the full history echo and repeats.\n"
+        "Latency is measured from sending the line to receiving the last echo byte.\n"
+        "Echoes are checked to hold only whole bench records, start from an empty history.\n"
+        "\n"
+        "Arguments:\n"
+        "  -c   Concurrent connections. Default: 8.\n"
+        "  -n   Lines sent per connection. Default: 100.\n"
+        "  -s   Line size in bytes including the newline, at least 24. Default: 64.\n"
+        "  -r   Lines per second per connection, latency is then measured from the\n"
+        "       scheduled send time. Default: 0, send as fast as the echoes return.\n"
+        "  -p   Server port on 127.0.0.1. Default: 9000.\n"
+        "  -h   Display this help text.\n"
+    );
+}
+
+size_t ParseSizeArgument(const char* argument)
+{
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(argument, &end, 10);
+    if (end == argument || *end != '\0' || errno != 0 || argument[0] == '-')
+    {
+        PrintHelp();
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)value;
+}
+
+int main(int argc, char** argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "c:n:s:r:p:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                g_connectionCount = ParseSizeArgument(optarg);
+                break;
+
+            case 'n':
+                g_lineCount = ParseSizeArgument(optarg);
+                break;
+
+            case 's':
+                g_lineSize = ParseSizeArgument(optarg);
+                break;
+
+            case 'r':
+                g_lineRate = ParseSizeArgument(optarg);
+                break;
+
+            case 'p':
+            {
+                size_t port = ParseSizeArgument(optarg);
+                if (port == 0 || port > UINT16_MAX)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                g_port = (uint16_t)port;
+                break;
+            }
+
+            case 'h':
+                PrintHelp();
+                exit(EXIT_SUCCESS);
+
+            default:
+                PrintHelp();
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (g_connectionCount == 0 || g_lineCount == 0 || g_lineSize < MIN_LINE_SIZE)
+    {
+        PrintHelp();
+        exit(EXIT_FAILURE);
+    }
+
+    struct Connection* connections = calloc(g_connectionCount, sizeof(struct Connection));
+    if (connections == NULL)
+    {
+        fprintf(stderr, "Cannot allocate connection memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < g_connectionCount; i++)
+    {
+        connections[i].index = i;
+        connections[i].echoBufferSize = g_lineSize * 16;
+        connections[i].echoBuffer = malloc(connections[i].echoBufferSize);
+        connections[i].latencies = malloc(g_lineCount * sizeof(uint64_t));
+        if (connections[i].echoBuffer == NULL || connections[i].latencies == NULL)
+        {
+            fprintf(stderr, "Cannot allocate connection memory.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        connections[i].socket = ConnectServer();
+        if (connections[i].socket == -1)
+        {
+            fprintf(stderr, "Cannot connect to 127.0.0.1:%u. Error Text: \"%s\".\n", g_port, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // All connections are established before the clock starts.
+    pthread_barrier_init(&g_startBarrier, NULL, g_connectionCount + 1);
+    for (size_t i = 0; i < g_connectionCount; i++)
+    {
+        if (pthread_create(&connections[i].threadId, NULL, &ConnectionLoop, &connections[i]) != 0)
+        {
+            fprintf(stderr, "Cannot create connection thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    pthread_barrier_wait(&g_startBarrier);
+    uint64_t startTime = MonotonicClock();
+    for (size_t i = 0; i < g_connectionCount; i++)
+        pthread_join(connections[i].threadId, NULL);
+    double elapsedSeconds = (double)(MonotonicClock() - startTime) / 1e9;
+    pthread_barrier_destroy(&g_startBarrier);
+
+    size_t sampleCount = 0;
+    for (size_t i = 0; i < g_connectionCount; i++)
+        sampleCount += connections[i].latencyCount;
+
+    uint64_t* latencies = malloc((sampleCount > 0 ? sampleCount : 1) * sizeof(uint64_t));
+    if (latencies == NULL)
+    {
+        fprintf(stderr, "Cannot allocate latency memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t errorCount = 0;
+    uint64_t echoBytes = 0;
+    size_t sampleIndex = 0;
+    for (size_t i = 0; i < g_connectionCount; i++)
+    {
+        memcpy(&latencies[sampleIndex], connections[i].latencies, connections[i].latencyCount * sizeof(uint64_t));
+        sampleIndex += connections[i].latencyCount;
+        errorCount += connections[i].errorCount;
+        echoBytes += connections[i].echoBytes;
+
+        close(connections[i].socket);
+        free(connections[i].echoBuffer);
+        free(connections[i].latencies);
+    }
+    free(connections);
+
+    printf("connections: %zu, lines: %zu, line size: %zu, rate: ", g_connectionCount, sampleCount, g_lineSize);
+    if (g_lineRate != 0)
+        printf("%zu/s per connection\n", g_lineRate);
+    else
+        printf("closed loop\n");
+    printf("elapsed: %.3f s, %.1f lines/s, echo %.1f MiB/s\n",
+        elapsedSeconds,
+        (double)sampleCount / elapsedSeconds,
+        (double)echoBytes / elapsedSeconds / (1024.0 * 1024.0)
+    );
+
+    if (sampleCount > 0)
+    {
+        qsort(latencies, sampleCount, sizeof(uint64_t), &CompareLatencies);
+        printf("latency us: p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n",
+            Percentile(latencies, sampleCount, 0.50),
+            Percentile(latencies, sampleCount, 0.99),
+            Percentile(latencies, sampleCount, 0.999),
+            (double)latencies[sampleCount - 1] / 1000.0
+        );
+    }
+    free(latencies);
+
+    printf("errors: %zu\n", errorCount);
+    return errorCount == 0 && sampleCount == g_connectionCount * g_lineCount ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,18 +1,59 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <time.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <syslog.h>
 #include <signal.h>
+#include <getopt.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
 #include <pthread.h>
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+#include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
+#include "queue.h"
+#include "metrics-histogram.h"
 
 #define USE_AESD_CHAR_DEVICE 1
+#define MAX_EPOLL_EVENTS 64
+#define URING_QUEUE_DEPTH 8
+#define URING_BUFFER_SIZE 4096
+#define SENDFILE_CHUNK_SIZE (1024 * 1024)
+#define ECHO_CHUNK_SIZE (16 * 1024)
+#define FRAMING_LENGTH_HANDSHAKE 0x00
+#define FRAMING_PREFIX_SIZE 4
+#define MAX_FLUSH_IOVECS 64
+#define BUFFER_POOL_MIN_SIZE 64
+#define BUFFER_POOL_CLASS_COUNT 11
+#define BUFFER_POOL_MAX_CACHED 256
+#define CLIENT_POOL_MAX_CACHED 1024
+#define LOG_RING_SLOTS 64
+#define LOG_MESSAGE_SIZE 192
+#define LOG_FLUSH_INTERVAL_MS 10
 
 #define RETRY_ON_INTERRUPT(expression)                  \
 ({                                                      \
@@ -35,25 +76,219 @@
     RETRY_ON_INTERRUPT_result;                          \
 })
 
+enum Framing
+{
+    // Records end at '\n':
+    FRAMING_LINE,
+    // Records carry a 32-bit big-endian length prefix:
+    FRAMING_LENGTH,
+    // A leading FRAMING_LENGTH_HANDSHAKE byte selects length framing, anything else lines:
+    FRAMING_AUTO
+};
+
+enum EchoMode
+{
+    // Every echo replays the whole history:
+    ECHO_FULL,
+    // Every echo carries only the records appended since the previous echo to that client:
+    ECHO_TAIL
+};
+
+struct HistoryRecord
+{
+    // One reference held by the history cache, one per client echo still pending:
+    atomic_size_t referenceCount;
+    size_t size;
+    char data[];
+};
+
 struct Client
 {
     int socket;
-    struct sockaddr_in address;
+    struct sockaddr_storage address;
     pthread_t threadId;
     size_t lineBufferCursor;
     size_t lineBufferSize;
     char* lineBuffer;
-    struct Client* next;
+    // Length framing state, the prefix may arrive split across receives:
+    enum Framing framing;
+    size_t recordPrefixCursor;
+    uint8_t recordPrefix[FRAMING_PREFIX_SIZE];
+    size_t recordSize;
+    // Tail echo position, the first echo to a client (position 0) replays the whole history:
+    off_t echoOffset;
+    size_t echoSequence;
+    // Pending echo bytes:
+    size_t sendBufferOffset;
+    size_t sendBufferCursor;
+    size_t sendBufferSize;
+    char* sendBuffer;
+    // Pending echo records from the history cache:
+    size_t pendingRecordIndex;
+    size_t pendingRecordOffset;
+    size_t pendingRecordCount;
+    size_t pendingRecordBytes;
+    size_t pendingRecordsSize;
+    struct HistoryRecord** pendingRecords;
+    // Records completed by one recv in batching mode:
+    size_t batchRecordsSize;
+    struct iovec* batchRecords;
+    // Reading is paused while the pending echo is above the high watermark:
+    bool readPaused;
+    // The peer finished sending, the client is torn down once its echo is flushed:
+    bool closePending;
+    // Event loop worker serving the client:
+    struct Worker* worker;
+    // Set once TearDownServer() owns joining the client thread:
+    bool joinPending;
+    // Links the client into g_clients, or into g_clientPool while it is recycled:
+    TAILQ_ENTRY(Client) entries;
+};
+
+TAILQ_HEAD(ClientList, Client);
+
+struct BufferPoolClass
+{
+    // Free buffers are chained through their first bytes:
+    void* freeList;
+    size_t freeCount;
+};
+
+struct Worker
+{
+    pthread_t threadId;
+    bool running;
+    int serverSocket;
+    int epollFd;
+    // Only touched by the worker itself:
+    struct ClientList clients;
+    size_t clientCount;
+};
+
+struct ThreadSlot
+{
+    // Claimed by one thread at a time, handed to the next thread once the owner exits:
+    atomic_bool inUse;
+    struct ThreadSlot* next;
+};
+
+struct LogEntry
+{
+    int priority;
+    char message[LOG_MESSAGE_SIZE];
+};
+
+struct LogRing
+{
+    struct ThreadSlot slot;
+    // Single producer (the owning thread), single consumer (the flusher):
+    _Alignas(64) atomic_size_t head;
+    atomic_size_t droppedCount;
+    _Alignas(64) atomic_size_t tail;
+    size_t reportedDropCount;
+    struct LogEntry entries[LOG_RING_SLOTS];
+};
+
+enum MetricCounter
+{
+    METRIC_CONNECTIONS_ACCEPTED,
+    METRIC_CONNECTIONS_CLOSED,
+    METRIC_BYTES_RECEIVED,
+    METRIC_BYTES_SENT,
+    METRIC_LINES_PROCESSED,
+    METRIC_COUNTER_COUNT
+};
+
+enum MetricHistogram
+{
+    METRIC_PROCESS_LATENCY,
+    METRIC_OUTPUT_LOCK_WAIT,
+    METRIC_OUTPUT_LOCK_HOLD,
+    METRIC_HISTOGRAM_COUNT
+};
+
+struct ThreadMetrics
+{
+    struct ThreadSlot slot;
+    atomic_uint_least64_t counters[METRIC_COUNTER_COUNT];
+    atomic_uint_least64_t histogramBuckets[METRIC_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS];
+    atomic_uint_least64_t histogramSums[METRIC_HISTOGRAM_COUNT];
 };
 
 static bool g_exitProgram = false;
+static int g_workerExitCode = EXIT_SUCCESS;
+static bool g_eventLoopMode = false;
+static bool g_uringMode = false;
+static bool g_persistentFileMode = false;
+static int g_outputFile = -1;
+static bool g_historyCacheMode = false;
+static bool g_batchMode = false;
+static enum Framing g_framingMode = FRAMING_LINE;
+static enum EchoMode g_echoMode = ECHO_FULL;
+static size_t g_maxLineLength = 16 * 1024 * 1024;
+static size_t g_maxPendingBytes = 64 * 1024 * 1024;
+static size_t g_sendHighWatermark = 1024 * 1024;
+static size_t g_sendLowWatermark = 256 * 1024;
+static size_t g_sendTimeoutMs = 30000;
+static size_t g_drainTimeoutMs = 2000;
+static int g_listenBacklog = SOMAXCONN;
+static size_t g_receiveBufferSize = 0;
+static size_t g_sendBufferSize = 0;
+static bool g_noDelayMode = true;
+static bool g_corkMode = true;
+static struct HistoryRecord** g_historyRecords;
+static size_t g_historyStart;
+static size_t g_historyCount;
+static size_t g_historyCapacity;
+static size_t g_historyEvicted;
+#if USE_AESD_CHAR_DEVICE == 1
+    static off_t g_appendedBytes;
+    static size_t g_historyBytes;
+    static size_t g_deviceRingEntries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    static size_t g_deviceRingBytes = 0;
+    static const volatile struct aesd_mmap_header* g_historyMap;
+    static const char* g_historyMapData;
+    static size_t g_historyMapDataSize;
+    static size_t g_historyMapLength;
+#endif
+#if USE_AESD_CHAR_DEVICE != 1
+    static bool g_zeroCopyDisabled = false;
+#endif
 static int g_serverSocket = -1;
-static struct Client* g_clientListHead;
+static uint16_t g_serverPort = 9000;
+static bool g_ipv6Mode = false;
+static int g_unixSocket = -1;
+static const char* g_unixSocketPath;
+static int g_wakeupFd = -1;
+static struct Worker* g_workers;
+static size_t g_workerCount = 0;
+static struct ClientList g_clients = TAILQ_HEAD_INITIALIZER(g_clients);
+static struct Client** g_clientTable;
+static size_t g_clientTableSize;
 static pthread_mutex_t g_clientListMutex;
 static pthread_mutex_t g_outputFileMutex;
+static pthread_mutex_t g_bufferPoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static struct BufferPoolClass g_bufferPool[BUFFER_POOL_CLASS_COUNT];
+static struct ClientList g_clientPool = TAILQ_HEAD_INITIALIZER(g_clientPool);
+static size_t g_clientPoolCount;
+static bool g_logFlusherRunning = false;
+static atomic_bool g_logFlusherStopping;
+static pthread_t g_logFlusherThreadId;
+static pthread_key_t g_logRingKey;
+static _Atomic(struct ThreadSlot*) g_logRings;
+static bool g_metricsMode = false;
+static size_t g_metricsPort = 0;
+static int g_metricsSocket = -1;
+static bool g_metricsRunning = false;
+static pthread_t g_metricsThreadId;
+static pthread_key_t g_metricsKey;
+static _Atomic(struct ThreadSlot*) g_metricsList;
+static uint64_t g_outputFileLockTime;
+static _Thread_local bool g_outputFileLocked;
 static struct sigaction g_oldSigtermHandler;
 static struct sigaction g_oldSigintHandler;
 const size_t g_lineBufferStartSize = 64;
+const size_t g_sendBufferStartSize = 512;
 
 #if USE_AESD_CHAR_DEVICE == 1
     static const char* g_outputFilePath = "/dev/aesdchar";
@@ -61,245 +296,2587 @@ const size_t g_lineBufferStartSize = 64;
     static const char* g_outputFilePath = "/var/tmp/aesdsocketdata";
 #endif
 
+static const char* const g_metricCounterNames[METRIC_COUNTER_COUNT][2] = {
+    { "aesdsocket_connections_accepted_total", "Client connections accepted." },
+    { "aesdsocket_connections_closed_total", "Client connections torn down." },
+    { "aesdsocket_received_bytes_total", "Bytes received from clients." },
+    { "aesdsocket_sent_bytes_total", "Echo bytes sent to clients." },
+    { "aesdsocket_lines_total", "Newline-terminated records appended." },
+};
+
+static const char* const g_metricHistogramNames[METRIC_HISTOGRAM_COUNT][2] = {
+    { "aesdsocket_process_seconds", "Time to append received records and echo the history." },
+    { "aesdsocket_output_lock_wait_seconds", "Time spent waiting for the output file lock." },
+    { "aesdsocket_output_lock_hold_seconds", "Time the output file lock was held." },
+};
+
+#ifdef USE_IO_URING
+enum UringOperation
+{
+    URING_WRITE,
+    URING_READ,
+    URING_SEND,
+    URING_OPERATION_COUNT
+};
+
+struct UringContext
+{
+    struct io_uring ring;
+    // Registered as fixed buffers 0 and 1:
+    char buffers[2][URING_BUFFER_SIZE];
+};
+
+static bool g_uringActive = false;
+static pthread_key_t g_uringKey;
+#endif
+
+void ReleaseHistoryRecord(struct HistoryRecord* record)
+{
+    if (atomic_fetch_sub_explicit(&record->referenceCount, 1, memory_order_acq_rel) == 1)
+        free(record);
+}
+
+/**
+ * Hands out a buffer of at least *size bytes from the size class pool and stores the real
+ * capacity in *size. Sizes above the largest class go straight to the heap.
+ */
+void* AllocateBuffer(size_t* size)
+{
+    size_t classSize = BUFFER_POOL_MIN_SIZE;
+    for (size_t i = 0; i < BUFFER_POOL_CLASS_COUNT; i++, classSize *= 2)
+    {
+        if (*size > classSize)
+            continue;
+
+        *size = classSize;
+        pthread_mutex_lock(&g_bufferPoolMutex);
+        void* buffer = g_bufferPool[i].freeList;
+        if (buffer != NULL)
+        {
+            g_bufferPool[i].freeList = *(void**)buffer;
+            g_bufferPool[i].freeCount--;
+        }
+        pthread_mutex_unlock(&g_bufferPoolMutex);
+
+        return buffer != NULL ? buffer : malloc(classSize);
+    }
+
+    return malloc(*size);
+}
+
+/**
+ * Returns @param buffer to its size class. @param size must be the capacity AllocateBuffer() reported.
+ */
+void FreeBuffer(void* buffer, size_t size)
+{
+    if (buffer == NULL)
+        return;
+
+    size_t classSize = BUFFER_POOL_MIN_SIZE;
+    for (size_t i = 0; i < BUFFER_POOL_CLASS_COUNT; i++, classSize *= 2)
+    {
+        if (size != classSize)
+            continue;
+
+        pthread_mutex_lock(&g_bufferPoolMutex);
+        if (g_bufferPool[i].freeCount < BUFFER_POOL_MAX_CACHED)
+        {
+            *(void**)buffer = g_bufferPool[i].freeList;
+            g_bufferPool[i].freeList = buffer;
+            g_bufferPool[i].freeCount++;
+            buffer = NULL;
+        }
+        pthread_mutex_unlock(&g_bufferPoolMutex);
+        break;
+    }
+
+    free(buffer);
+}
+
+/**
+ * Exponential growth for pooled buffers: doubles *capacity (starting at @param startSize) until
+ * @param requiredSize fits and moves the first @param usedSize bytes over.
+ * @return the new buffer, or NULL with @param buffer left untouched.
+ */
+void* GrowBuffer(void* buffer, size_t* capacity, size_t usedSize, size_t requiredSize, size_t startSize)
+{
+    if (requiredSize <= *capacity)
+        return buffer;
+
+    size_t newCapacity = *capacity == 0 ? startSize : *capacity;
+    while (newCapacity < requiredSize)
+        newCapacity *= 2;
+
+    void* newBuffer = AllocateBuffer(&newCapacity);
+    if (newBuffer == NULL)
+        return NULL;
+
+    if (buffer != NULL)
+    {
+        memcpy(newBuffer, buffer, usedSize);
+        FreeBuffer(buffer, *capacity);
+    }
+
+    *capacity = newCapacity;
+    return newBuffer;
+}
+
+struct Client* AllocateClient()
+{
+    pthread_mutex_lock(&g_bufferPoolMutex);
+    struct Client* client = TAILQ_FIRST(&g_clientPool);
+    if (client != NULL)
+    {
+        TAILQ_REMOVE(&g_clientPool, client, entries);
+        g_clientPoolCount--;
+    }
+    pthread_mutex_unlock(&g_bufferPoolMutex);
+
+    if (client == NULL)
+        client = (struct Client*)malloc(sizeof(struct Client));
+
+    if (client != NULL)
+        memset(client, 0, sizeof(struct Client));
+    return client;
+}
+
+void ReleaseClient(struct Client* client)
+{
+    pthread_mutex_lock(&g_bufferPoolMutex);
+    if (g_clientPoolCount < CLIENT_POOL_MAX_CACHED)
+    {
+        TAILQ_INSERT_HEAD(&g_clientPool, client, entries);
+        g_clientPoolCount++;
+        client = NULL;
+    }
+    pthread_mutex_unlock(&g_bufferPoolMutex);
+
+    free(client);
+}
+
+void TearDownPools()
+{
+    pthread_mutex_lock(&g_bufferPoolMutex);
+    for (size_t i = 0; i < BUFFER_POOL_CLASS_COUNT; i++)
+    {
+        while (g_bufferPool[i].freeList != NULL)
+        {
+            void* buffer = g_bufferPool[i].freeList;
+            g_bufferPool[i].freeList = *(void**)buffer;
+            free(buffer);
+        }
+        g_bufferPool[i].freeCount = 0;
+    }
+
+    while (!TAILQ_EMPTY(&g_clientPool))
+    {
+        struct Client* client = TAILQ_FIRST(&g_clientPool);
+        TAILQ_REMOVE(&g_clientPool, client, entries);
+        free(client);
+    }
+    g_clientPoolCount = 0;
+    pthread_mutex_unlock(&g_bufferPoolMutex);
+}
+
+void ReleaseThreadSlot(void* slot)
+{
+    atomic_store_explicit(&((struct ThreadSlot*)slot)->inUse, false, memory_order_release);
+}
+
+/**
+ * Returns the calling thread's slot of @param list, claiming a released slot or linking a new zeroed
+ * one of @param size bytes on first use. Slots are never unlinked or freed; @param key must have been
+ * created with ReleaseThreadSlot() as destructor so an exiting thread hands its slot on.
+ */
+struct ThreadSlot* CurrentThreadSlot(pthread_key_t key, _Atomic(struct ThreadSlot*)* list, size_t size)
+{
+    struct ThreadSlot* slot = pthread_getspecific(key);
+    if (slot != NULL)
+        return slot;
+
+    for (slot = atomic_load_explicit(list, memory_order_acquire); slot != NULL; slot = slot->next)
+    {
+        bool expected = false;
+        if (atomic_compare_exchange_strong_explicit(&slot->inUse, &expected, true, memory_order_acquire, memory_order_relaxed))
+            break;
+    }
+
+    if (slot == NULL)
+    {
+        // Cache line aligned, owners must not share a line with each other.
+        size = (size + 63) & ~(size_t)63;
+        slot = aligned_alloc(64, size);
+        if (slot == NULL)
+            return NULL;
+
+        memset(slot, 0, size);
+        atomic_init(&slot->inUse, true);
+        slot->next = atomic_load_explicit(list, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(list, &slot->next, slot, memory_order_release, memory_order_relaxed))
+            ;
+    }
+
+    pthread_setspecific(key, slot);
+    return slot;
+}
+
+struct LogRing* CurrentLogRing()
+{
+    return (struct LogRing*)CurrentThreadSlot(g_logRingKey, &g_logRings, sizeof(struct LogRing));
+}
+
+/**
+ * syslog() replacement. While the flusher runs, the message is formatted into the calling thread's
+ * ring and forwarded later, so the caller never blocks on /dev/log; a full ring drops the message.
+ * Before the flusher starts and after it stops, messages go to syslog() directly.
+ */
+void LogMessage(int priority, const char* format, ...)
+{
+    int savedErrno = errno;
+    va_list arguments;
+    va_start(arguments, format);
+
+    struct LogRing* ring = g_logFlusherRunning ? CurrentLogRing() : NULL;
+    if (ring == NULL)
+    {
+        vsyslog(priority, format, arguments);
+    }
+    else
+    {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == LOG_RING_SLOTS)
+        {
+            atomic_store_explicit(&ring->droppedCount, atomic_load_explicit(&ring->droppedCount, memory_order_relaxed) + 1, memory_order_relaxed);
+        }
+        else
+        {
+            struct LogEntry* entry = &ring->entries[head % LOG_RING_SLOTS];
+            entry->priority = priority;
+            vsnprintf(entry->message, sizeof(entry->message), format, arguments);
+            atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+        }
+    }
+
+    va_end(arguments);
+    errno = savedErrno;
+}
+
+/**
+ * Forwards everything queued so far. Messages keep their order per thread, not across threads.
+ */
+void FlushLogRings()
+{
+    struct ThreadSlot* slot = atomic_load_explicit(&g_logRings, memory_order_acquire);
+    for (; slot != NULL; slot = slot->next)
+    {
+        struct LogRing* ring = (struct LogRing*)slot;
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            struct LogEntry* entry = &ring->entries[tail % LOG_RING_SLOTS];
+            syslog(entry->priority, "%s", entry->message);
+            // Hand every slot back right away, a long burst can refill the ring while this runs.
+            atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+        }
+
+        size_t droppedCount = atomic_load_explicit(&ring->droppedCount, memory_order_relaxed);
+        if (droppedCount != ring->reportedDropCount)
+        {
+            syslog(LOG_WARNING, "Log ring was full, dropped %zu messages.", droppedCount - ring->reportedDropCount);
+            ring->reportedDropCount = droppedCount;
+        }
+    }
+}
+
+void* LogFlusherLoop(void* argument)
+{
+    (void)argument;
+
+    struct timespec interval = {
+        .tv_sec = 0,
+        .tv_nsec = LOG_FLUSH_INTERVAL_MS * 1000000,
+    };
+    while (true)
+    {
+        // Read before flushing, so the last pass sees everything queued before the stop request.
+        bool stopping = atomic_load(&g_logFlusherStopping);
+        FlushLogRings();
+        if (stopping)
+            return NULL;
+        nanosleep(&interval, NULL);
+    }
+}
+
+void StartLogFlusher()
+{
+    if (pthread_key_create(&g_logRingKey, ReleaseThreadSlot) != 0)
+    {
+        LogMessage(LOG_WARNING, "Cannot create log ring key, logging synchronously.");
+        return;
+    }
+
+    atomic_init(&g_logFlusherStopping, false);
+    if (pthread_create(&g_logFlusherThreadId, NULL, &LogFlusherLoop, NULL) != 0)
+    {
+        LogMessage(LOG_WARNING, "Cannot create log flusher thread, logging synchronously.");
+        return;
+    }
+    g_logFlusherRunning = true;
+}
+
+/**
+ * Drains the rings and switches back to synchronous logging. Must run after every other thread
+ * that logs has been joined.
+ */
+void StopLogFlusher()
+{
+    if (g_logFlusherRunning)
+    {
+        atomic_store(&g_logFlusherStopping, true);
+        pthread_join(g_logFlusherThreadId, NULL);
+        g_logFlusherRunning = false;
+    }
+    // The rings stay allocated: detached client threads may still be releasing theirs.
+}
+
+/**
+ * Returns the metrics block of the calling thread. Blocks are never unlinked, so the totals survive
+ * the threads that collected them.
+ */
+struct ThreadMetrics* CurrentThreadMetrics()
+{
+    return (struct ThreadMetrics*)CurrentThreadSlot(g_metricsKey, &g_metricsList, sizeof(struct ThreadMetrics));
+}
+
+void BumpMetric(atomic_uint_least64_t* metric, uint64_t value)
+{
+    // Only the owning thread writes, a plain load/store pair avoids a locked read-modify-write.
+    atomic_store_explicit(metric, atomic_load_explicit(metric, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+void AddMetric(enum MetricCounter counter, uint64_t value)
+{
+    if (!g_metricsMode)
+        return;
+
+    struct ThreadMetrics* metrics = CurrentThreadMetrics();
+    if (metrics != NULL)
+        BumpMetric(&metrics->counters[counter], value);
+}
+
+uint64_t MonotonicClock()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @return monotonic nanoseconds, or 0 without touching the clock when metrics are disabled.
+ */
+uint64_t MetricsClock()
+{
+    return g_metricsMode ? MonotonicClock() : 0;
+}
+
+void ObserveMetric(enum MetricHistogram histogram, uint64_t nanoseconds)
+{
+    if (!g_metricsMode)
+        return;
+
+    struct ThreadMetrics* metrics = CurrentThreadMetrics();
+    if (metrics == NULL)
+        return;
+
+    BumpMetric(&metrics->histogramBuckets[histogram][MetricsBucket(nanoseconds)], 1);
+    BumpMetric(&metrics->histogramSums[histogram], nanoseconds);
+}
+
+void LockOutputFile()
+{
+    uint64_t waitStart = MetricsClock();
+    pthread_mutex_lock(&g_outputFileMutex);
+    // Written and read only while the lock is held.
+    g_outputFileLockTime = MetricsClock();
+    g_outputFileLocked = true;
+    ObserveMetric(METRIC_OUTPUT_LOCK_WAIT, g_outputFileLockTime - waitStart);
+}
+
+void UnlockOutputFile()
+{
+    ObserveMetric(METRIC_OUTPUT_LOCK_HOLD, MetricsClock() - g_outputFileLockTime);
+    g_outputFileLocked = false;
+    pthread_mutex_unlock(&g_outputFileMutex);
+}
+
+/**
+ * Sums the per-thread blocks and prints them in the Prometheus text exposition format. Owners keep
+ * writing meanwhile, so a scrape is a consistent view of every counter but not across counters.
+ */
+void WriteMetrics(FILE* stream)
+{
+    uint64_t counters[METRIC_COUNTER_COUNT] = { 0 };
+    uint64_t buckets[METRIC_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS] = { { 0 } };
+    uint64_t sums[METRIC_HISTOGRAM_COUNT] = { 0 };
+
+    struct ThreadSlot* slot = atomic_load_explicit(&g_metricsList, memory_order_acquire);
+    for (; slot != NULL; slot = slot->next)
+    {
+        struct ThreadMetrics* metrics = (struct ThreadMetrics*)slot;
+        for (size_t i = 0; i < METRIC_COUNTER_COUNT; i++)
+            counters[i] += atomic_load_explicit(&metrics->counters[i], memory_order_relaxed);
+
+        for (size_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+        {
+            for (size_t j = 0; j < METRICS_HISTOGRAM_BUCKETS; j++)
+                buckets[i][j] += atomic_load_explicit(&metrics->histogramBuckets[i][j], memory_order_relaxed);
+            sums[i] += atomic_load_explicit(&metrics->histogramSums[i], memory_order_relaxed);
+        }
+    }
+
+    for (size_t i = 0; i < METRIC_COUNTER_COUNT; i++)
+    {
+        const char* name = g_metricCounterNames[i][0];
+        fprintf(stream, "# HELP %s %s\n# TYPE %s counter\n%s %" PRIu64 "\n", name, g_metricCounterNames[i][1], name, name, counters[i]);
+    }
+
+    for (size_t i = 0; i < METRIC_HISTOGRAM_COUNT; i++)
+    {
+        const char* name = g_metricHistogramNames[i][0];
+        fprintf(stream, "# HELP %s %s\n# TYPE %s histogram\n", name, g_metricHistogramNames[i][1], name);
+
+        uint64_t cumulativeCount = 0;
+        for (size_t j = 0; j < METRICS_HISTOGRAM_BUCKETS - 1; j++)
+        {
+            cumulativeCount += buckets[i][j];
+            fprintf(stream, "%s_bucket{le=\"%.9g\"} %" PRIu64 "\n", name, MetricsBucketBound(j), cumulativeCount);
+        }
+        cumulativeCount += buckets[i][METRICS_HISTOGRAM_BUCKETS - 1];
+
+        fprintf(stream, "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n", name, cumulativeCount);
+        fprintf(stream, "%s_sum %.9f\n", name, (double)sums[i] * 1e-9);
+        fprintf(stream, "%s_count %" PRIu64 "\n", name, cumulativeCount);
+    }
+}
+
+void TearDownMetrics()
+{
+    // The blocks stay allocated like the log rings, detached client threads may still release theirs.
+    g_metricsMode = false;
+}
+
 void TearDownClient(struct Client* client)
 {
-    syslog(LOG_INFO, "Terminating client... Client Id: %ld.", client->threadId);
+    AddMetric(METRIC_CONNECTIONS_CLOSED, 1);
+
+    if (g_eventLoopMode)
+        LogMessage(LOG_INFO, "Terminating client... Client Socket: %d.", client->socket);
+    else
+        LogMessage(LOG_INFO, "Terminating client... Client Id: %ld.", client->threadId);
 
+    FreeBuffer(client->lineBuffer, client->lineBufferSize);
+    client->lineBuffer = NULL;
+
+    FreeBuffer(client->sendBuffer, client->sendBufferSize);
+    client->sendBuffer = NULL;
+
+    FreeBuffer(client->batchRecords, client->batchRecordsSize);
+    client->batchRecords = NULL;
+
+    if (client->pendingRecords != NULL)
+    {
+        for (size_t i = client->pendingRecordIndex; i < client->pendingRecordCount; i++)
+            ReleaseHistoryRecord(client->pendingRecords[i]);
+        FreeBuffer(client->pendingRecords, client->pendingRecordsSize);
+        client->pendingRecords = NULL;
+    }
+
+    if (g_eventLoopMode)
+    {
+        // Unmapped before close(), another worker may accept the same descriptor number right after.
+        g_clientTable[client->socket] = NULL;
+        epoll_ctl(client->worker->epollFd, EPOLL_CTL_DEL, client->socket, NULL);
+        close(client->socket);
+        TAILQ_REMOVE(&client->worker->clients, client, entries);
+        client->worker->clientCount--;
+        ReleaseClient(client);
+        return;
+    }
+
+    pthread_mutex_lock(&g_clientListMutex);
+    TAILQ_REMOVE(&g_clients, client, entries);
+    bool joinPending = client->joinPending;
+    pthread_mutex_unlock(&g_clientListMutex);
+
+    // Closed only once unlisted, until then TearDownServer() may shut the socket down.
     close(client->socket);
 
-    if (client->lineBuffer != NULL)
+    // Nobody will join a thread that leaves on its own, let it release its resources itself.
+    if (!joinPending)
+        pthread_detach(client->threadId);
+
+    ReleaseClient(client);
+}
+
+/**
+ * Sets g_exitProgram and wakes the acceptor or the workers, which watch g_wakeupFd.
+ * Async-signal-safe.
+ */
+void RequestExit()
+{
+    g_exitProgram = true;
+
+    if (g_wakeupFd != -1)
+    {
+        uint64_t value = 1;
+        ssize_t writeResult = write(g_wakeupFd, &value, sizeof(value));
+        (void)writeResult;
+    }
+}
+
+void TearDownServer(int exitCode)
+{
+    LogMessage(LOG_INFO, "Terminating server...");
+
+    g_exitProgram = true;
+
+    // A failing worker only stops itself, the main thread joins it along with the others.
+    for (size_t i = 0; g_workers != NULL && i < g_workerCount; i++)
+    {
+        if (pthread_equal(g_workers[i].threadId, pthread_self()))
+        {
+            g_workerExitCode = exitCode;
+            RequestExit();
+            // The other workers still append while they drain.
+            if (g_outputFileLocked)
+                UnlockOutputFile();
+            while (!TAILQ_EMPTY(&g_workers[i].clients))
+                TearDownClient(TAILQ_FIRST(&g_workers[i].clients));
+            pthread_exit(NULL);
+        }
+    }
+
+    // Claim every client thread and stop its input in one pass: idle threads return from recv()
+    // right away, busy ones finish the lines they already received and echo them.
+    pthread_mutex_lock(&g_clientListMutex);
+    size_t threadCount = 0;
+    struct Client* currentClient;
+    TAILQ_FOREACH(currentClient, &g_clients, entries)
+        threadCount++;
+
+    pthread_t* threadIds = threadCount > 0 ? malloc(threadCount * sizeof(pthread_t)) : NULL;
+    size_t joinCount = 0;
+    TAILQ_FOREACH(currentClient, &g_clients, entries)
+    {
+        if (threadIds == NULL || pthread_equal(currentClient->threadId, pthread_self()))
+            continue;
+        currentClient->joinPending = true;
+        threadIds[joinCount++] = currentClient->threadId;
+        shutdown(currentClient->socket, SHUT_RD);
+    }
+    pthread_mutex_unlock(&g_clientListMutex);
+
+    struct timespec drainDeadline;
+    clock_gettime(CLOCK_REALTIME, &drainDeadline);
+    drainDeadline.tv_sec += g_drainTimeoutMs / 1000;
+    drainDeadline.tv_nsec += (g_drainTimeoutMs % 1000) * 1000000;
+    if (drainDeadline.tv_nsec >= 1000000000)
+    {
+        drainDeadline.tv_sec++;
+        drainDeadline.tv_nsec -= 1000000000;
+    }
+
+    size_t stragglerCount = 0;
+    for (size_t i = 0; i < joinCount; i++)
+    {
+        if (pthread_timedjoin_np(threadIds[i], NULL, &drainDeadline) != 0)
+            threadIds[stragglerCount++] = threadIds[i];
+    }
+
+    // Past the deadline, fail whatever the stragglers are blocked on.
+    if (stragglerCount > 0)
+    {
+        LogMessage(LOG_WARNING, "Drain deadline passed, aborting clients. Client Count: %zu.", stragglerCount);
+
+        pthread_mutex_lock(&g_clientListMutex);
+        TAILQ_FOREACH(currentClient, &g_clients, entries)
+        {
+            if (currentClient->joinPending)
+                shutdown(currentClient->socket, SHUT_RDWR);
+        }
+        pthread_mutex_unlock(&g_clientListMutex);
+
+        for (size_t i = 0; i < stragglerCount; i++)
+            pthread_join(threadIds[i], NULL);
+    }
+    free(threadIds);
+
+    if (g_metricsRunning && !pthread_equal(g_metricsThreadId, pthread_self()))
+    {
+        pthread_cancel(g_metricsThreadId);
+        pthread_join(g_metricsThreadId, NULL);
+        g_metricsRunning = false;
+    }
+
+    if (g_metricsSocket != -1)
+    {
+        close(g_metricsSocket);
+        g_metricsSocket = -1;
+    }
+
+    if (g_workers != NULL)
+    {
+        // Woken here, each worker drains and tears down its own clients before leaving. Never
+        // cancelled, a worker may hold g_outputFileMutex or be in the middle of a write.
+        RequestExit();
+        for (size_t i = 0; i < g_workerCount; i++)
+        {
+            if (g_workers[i].running)
+            {
+                pthread_join(g_workers[i].threadId, NULL);
+                g_workers[i].running = false;
+            }
+        }
+
+        for (size_t i = 0; i < g_workerCount; i++)
+        {
+            if (g_workers[i].epollFd != -1)
+                close(g_workers[i].epollFd);
+            if (g_workers[i].serverSocket != -1 && g_workers[i].serverSocket != g_serverSocket)
+                close(g_workers[i].serverSocket);
+        }
+        free(g_workers);
+        g_workers = NULL;
+    }
+
+    free(g_clientTable);
+    g_clientTable = NULL;
+
+    // Every thread that logs is gone, anything logged from here on goes out synchronously.
+    StopLogFlusher();
+
+    if (g_wakeupFd != -1)
+    {
+        close(g_wakeupFd);
+        g_wakeupFd = -1;
+    }
+
+    #ifdef USE_IO_URING
+        // The rings belong to the threads joined above, their key destructors released them.
+        g_uringActive = false;
+    #endif
+
+    if (g_outputFile != -1)
+    {
+        close(g_outputFile);
+        g_outputFile = -1;
+    }
+
+    #if USE_AESD_CHAR_DEVICE == 1
+        if (g_historyMap != NULL)
+        {
+            munmap((void*)g_historyMap, g_historyMapLength);
+            g_historyMap = NULL;
+        }
+    #endif
+
+    if (g_historyRecords != NULL)
+    {
+        for (size_t i = 0; i < g_historyCount; i++)
+            ReleaseHistoryRecord(g_historyRecords[(g_historyStart + i) % g_historyCapacity]);
+        free(g_historyRecords);
+        g_historyRecords = NULL;
+        g_historyCount = 0;
+    }
+
+    TearDownPools();
+    TearDownMetrics();
+
+    #if USE_AESD_CHAR_DEVICE != 1
+        remove(g_outputFilePath);
+    #endif
+
+    if (g_serverSocket != -1)
+    {
+        close(g_serverSocket);
+        g_serverSocket = -1;
+    }
+
+    if (g_unixSocket != -1)
+    {
+        close(g_unixSocket);
+        unlink(g_unixSocketPath);
+        g_unixSocket = -1;
+    }
+
+    if (g_exitProgram)
+        LogMessage(LOG_ERR, "Caught signal exiting");
+
+    closelog();
+
+    sigaction(SIGTERM, &g_oldSigtermHandler, NULL);
+    sigaction(SIGINT, &g_oldSigintHandler, NULL);
+
+    LogMessage(LOG_INFO, "Exiting process...");
+
+    // The main thread reaches this with EXIT_SUCCESS after joining a worker that failed.
+    exit(exitCode == EXIT_SUCCESS ? g_workerExitCode : exitCode);
+}
+
+bool ReserveSendBuffer(struct Client* client, size_t size)
+{
+    char* newBuffer = GrowBuffer(client->sendBuffer, &client->sendBufferSize, client->sendBufferCursor, client->sendBufferCursor + size, g_sendBufferStartSize);
+    if (newBuffer == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot reallocate send buffer memory.");
+        return false;
+    }
+    client->sendBuffer = newBuffer;
+
+    return true;
+}
+
+bool QueueBytes(struct Client* client, const char* bytes, size_t size)
+{
+    if (!ReserveSendBuffer(client, size))
+        return false;
+
+    memcpy(&client->sendBuffer[client->sendBufferCursor], bytes, size);
+    client->sendBufferCursor += size;
+    return true;
+}
+
+size_t PendingBytes(struct Client* client)
+{
+    return client->sendBufferCursor - client->sendBufferOffset + client->pendingRecordBytes;
+}
+
+/**
+ * Sends as much of the pending echo as the socket takes. Event loop sockets stop at EAGAIN and
+ * continue on EPOLLOUT; for blocking sockets EAGAIN means the send timeout expired.
+ * @return false if the client was torn down.
+ */
+bool FlushClient(struct Client* client)
+{
+    while (client->sendBufferOffset < client->sendBufferCursor)
+    {
+        // More of the echo follows, let the stack fill whole segments.
+        int sendFlags = MSG_NOSIGNAL;
+        if (g_corkMode && client->pendingRecordIndex < client->pendingRecordCount)
+            sendFlags |= MSG_MORE;
+
+        ssize_t sendResult = RETRY_ON_INTERRUPT(send(
+            client->socket,
+            &client->sendBuffer[client->sendBufferOffset],
+            client->sendBufferCursor - client->sendBufferOffset,
+            sendFlags
+        ));
+        if (sendResult == -1)
+        {
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && g_eventLoopMode)
+                return true;
+
+            LogMessage(LOG_ERR, "Cannot send bytes to client. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownClient(client);
+            return false;
+        }
+        client->sendBufferOffset += sendResult;
+        AddMetric(METRIC_BYTES_SENT, sendResult);
+    }
+
+    client->sendBufferOffset = 0;
+    client->sendBufferCursor = 0;
+
+    while (client->pendingRecordIndex < client->pendingRecordCount)
+    {
+        struct iovec vectors[MAX_FLUSH_IOVECS];
+        size_t vectorCount = 0;
+        for (size_t i = client->pendingRecordIndex; i < client->pendingRecordCount && vectorCount < MAX_FLUSH_IOVECS; i++)
+        {
+            size_t offset = i == client->pendingRecordIndex ? client->pendingRecordOffset : 0;
+            vectors[vectorCount].iov_base = &client->pendingRecords[i]->data[offset];
+            vectors[vectorCount].iov_len = client->pendingRecords[i]->size - offset;
+            vectorCount++;
+        }
+
+        int sendFlags = MSG_NOSIGNAL;
+        if (g_corkMode && client->pendingRecordIndex + vectorCount < client->pendingRecordCount)
+            sendFlags |= MSG_MORE;
+
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = vectors;
+        message.msg_iovlen = vectorCount;
+        ssize_t sendResult = RETRY_ON_INTERRUPT(sendmsg(client->socket, &message, sendFlags));
+        if (sendResult == -1)
+        {
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && g_eventLoopMode)
+                return true;
+
+            LogMessage(LOG_ERR, "Cannot send bytes to client. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownClient(client);
+            return false;
+        }
+
+        AddMetric(METRIC_BYTES_SENT, sendResult);
+        size_t sentBytes = sendResult;
+        while (sentBytes > 0)
+        {
+            struct HistoryRecord* record = client->pendingRecords[client->pendingRecordIndex];
+            size_t remainingBytes = record->size - client->pendingRecordOffset;
+            if (sentBytes < remainingBytes)
+            {
+                client->pendingRecordOffset += sentBytes;
+                client->pendingRecordBytes -= sentBytes;
+                break;
+            }
+
+            sentBytes -= remainingBytes;
+            client->pendingRecordBytes -= remainingBytes;
+            ReleaseHistoryRecord(record);
+            client->pendingRecordIndex++;
+            client->pendingRecordOffset = 0;
+        }
+    }
+
+    client->pendingRecordIndex = 0;
+    client->pendingRecordCount = 0;
+    return true;
+}
+
+struct HistoryRecord* CreateHistoryRecord(const char* data, size_t size)
+{
+    struct HistoryRecord* record = malloc(sizeof(struct HistoryRecord) + size);
+    if (record == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot allocate history record memory.");
+        return NULL;
+    }
+
+    atomic_init(&record->referenceCount, 1);
+    record->size = size;
+    memcpy(record->data, data, size);
+    return record;
+}
+
+/**
+ * Takes over the cache reference of @param record. Must be called with g_outputFileMutex held.
+ * The char device keeps only its most recent writes within its ring entry and byte budget, so
+ * the cache evicts the same way; the regular file cache grows with the file.
+ */
+bool AppendHistory(struct HistoryRecord* record)
+{
+    #if USE_AESD_CHAR_DEVICE == 1
+        while (g_historyCount > 0 &&
+            (g_historyCount == g_deviceRingEntries || (g_deviceRingBytes != 0 && g_historyBytes + record->size > g_deviceRingBytes)))
+        {
+            g_historyBytes -= g_historyRecords[g_historyStart]->size;
+            ReleaseHistoryRecord(g_historyRecords[g_historyStart]);
+            g_historyStart = (g_historyStart + 1) % g_historyCapacity;
+            g_historyCount--;
+            g_historyEvicted++;
+        }
+    #endif
+
+    if (g_historyCount == g_historyCapacity)
+    {
+        size_t newCapacity = g_historyCapacity == 0 ? AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED : g_historyCapacity * 2;
+        struct HistoryRecord** newRecords = malloc(newCapacity * sizeof(struct HistoryRecord*));
+        if (newRecords == NULL)
+        {
+            LogMessage(LOG_ERR, "Cannot allocate history memory.");
+            ReleaseHistoryRecord(record);
+            return false;
+        }
+
+        for (size_t i = 0; i < g_historyCount; i++)
+            newRecords[i] = g_historyRecords[(g_historyStart + i) % g_historyCapacity];
+        free(g_historyRecords);
+
+        g_historyRecords = newRecords;
+        g_historyStart = 0;
+        g_historyCapacity = newCapacity;
+    }
+
+    g_historyRecords[(g_historyStart + g_historyCount) % g_historyCapacity] = record;
+    g_historyCount++;
+    #if USE_AESD_CHAR_DEVICE == 1
+        g_historyBytes += record->size;
+    #endif
+    return true;
+}
+
+/**
+ * Queues a reference to every cached record from the client's echo sequence on for the next
+ * FlushClient(). Must be called with g_outputFileMutex held; the records stay valid after
+ * eviction until the echo has been sent.
+ */
+bool QueueHistory(struct Client* client)
+{
+    size_t firstRecord = client->echoSequence > g_historyEvicted ? client->echoSequence - g_historyEvicted : 0;
+
+    struct HistoryRecord** newRecords = GrowBuffer(
+        client->pendingRecords,
+        &client->pendingRecordsSize,
+        client->pendingRecordCount * sizeof(struct HistoryRecord*),
+        (client->pendingRecordCount + g_historyCount - firstRecord) * sizeof(struct HistoryRecord*),
+        BUFFER_POOL_MIN_SIZE
+    );
+    if (newRecords == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot reallocate pending record memory.");
+        return false;
+    }
+    client->pendingRecords = newRecords;
+
+    for (size_t i = firstRecord; i < g_historyCount; i++)
+    {
+        struct HistoryRecord* record = g_historyRecords[(g_historyStart + i) % g_historyCapacity];
+        atomic_fetch_add_explicit(&record->referenceCount, 1, memory_order_relaxed);
+        client->pendingRecords[client->pendingRecordCount++] = record;
+        client->pendingRecordBytes += record->size;
+    }
+
+    if (g_echoMode == ECHO_TAIL)
+        client->echoSequence = g_historyEvicted + g_historyCount;
+    return true;
+}
+
+int OpenOutputFile()
+{
+    // O_APPEND keeps the regular file append-only, readback is positional from offset 0.
+    int outputFile = open(g_outputFilePath, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    if (outputFile == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot open file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+    return outputFile;
+}
+
+void ReleaseOutputFile(int outputFile)
+{
+    if (outputFile != g_outputFile)
+        close(outputFile);
+}
+
+void WarmUpHistory()
+{
+    LogMessage(LOG_INFO, "Loading history cache... File Path: \"%s\".", g_outputFilePath);
+
+    int outputFile = g_outputFile != -1 ? g_outputFile : OpenOutputFile();
+
+    #if USE_AESD_CHAR_DEVICE == 1
+        // Modules without the ioctl keep the compile-time ring size.
+        struct aesd_ring_config ringConfig;
+        if (ioctl(outputFile, AESDCHAR_IOCGETRING, &ringConfig) == 0)
+        {
+            g_deviceRingEntries = ringConfig.entries;
+            g_deviceRingBytes = ringConfig.bytes;
+        }
+    #endif
+
+    size_t contentsCursor = 0;
+    size_t contentsSize = 0;
+    char* contents = NULL;
+    while (true)
+    {
+        if (contentsCursor == contentsSize)
+        {
+            contentsSize = contentsSize == 0 ? 4096 : contentsSize * 2;
+            char* newContents = realloc(contents, contentsSize);
+            if (newContents == NULL)
+            {
+                LogMessage(LOG_ERR, "Cannot allocate history memory.");
+                TearDownServer(EXIT_FAILURE);
+            }
+            contents = newContents;
+        }
+
+        int readBytes = RETRY_ON_INTERRUPT(pread(outputFile, &contents[contentsCursor], contentsSize - contentsCursor, contentsCursor));
+        if (readBytes == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot read from file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+            TearDownServer(EXIT_FAILURE);
+        }
+        else if (readBytes == 0)
+        {
+            break;
+        }
+        contentsCursor += readBytes;
+    }
+    ReleaseOutputFile(outputFile);
+
+    // Every record the server writes ends with a newline, split the contents the same way.
+    size_t recordStart = 0;
+    while (recordStart < contentsCursor)
+    {
+        char* newline = memchr(&contents[recordStart], '\n', contentsCursor - recordStart);
+        size_t recordEnd = newline != NULL ? (size_t)(newline - contents) + 1 : contentsCursor;
+
+        struct HistoryRecord* record = CreateHistoryRecord(&contents[recordStart], recordEnd - recordStart);
+        if (record == NULL || !AppendHistory(record))
+            TearDownServer(EXIT_FAILURE);
+        recordStart = recordEnd;
+    }
+    free(contents);
+}
+
+#if USE_AESD_CHAR_DEVICE != 1
+/**
+ * Echoes the append-only output file from @param startOffset up to @param length. The range is
+ * immutable, so this runs without g_outputFileMutex. Uses sendfile() unless the client is served
+ * from the event loop, which cannot block in a transfer and queues the bytes instead.
+ */
+bool EchoFileRange(struct Client* client, int outputFile, off_t startOffset, off_t length)
+{
+    off_t readOffset = startOffset;
+
+    if (!g_eventLoopMode && !g_zeroCopyDisabled)
+    {
+        while (readOffset < length)
+        {
+            size_t chunkSize = length - readOffset < SENDFILE_CHUNK_SIZE ? (size_t)(length - readOffset) : SENDFILE_CHUNK_SIZE;
+            ssize_t sentBytes = RETRY_ON_INTERRUPT(sendfile(client->socket, outputFile, &readOffset, chunkSize));
+            if (sentBytes == -1)
+            {
+                if (readOffset == startOffset && (errno == EINVAL || errno == ENOSYS))
+                {
+                    LogMessage(LOG_WARNING, "Zero-copy echo is not supported, falling back to read/send. File Path: \"%s\".", g_outputFilePath);
+                    g_zeroCopyDisabled = true;
+                    break;
+                }
+
+                LogMessage(LOG_ERR, "Cannot send bytes to client. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+                return false;
+            }
+            else if (sentBytes == 0)
+            {
+                return true;
+            }
+            AddMetric(METRIC_BYTES_SENT, sentBytes);
+        }
+
+        if (!g_zeroCopyDisabled)
+            return true;
+    }
+
+    while (readOffset < length)
+    {
+        char fileBuffer[ECHO_CHUNK_SIZE];
+        size_t chunkSize = length - readOffset < (off_t)sizeof(fileBuffer) ? (size_t)(length - readOffset) : sizeof(fileBuffer);
+        int readBytes = RETRY_ON_INTERRUPT(pread(outputFile, fileBuffer, chunkSize, readOffset));
+        if (readBytes == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot read from file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+            return false;
+        }
+        else if (readBytes == 0)
+        {
+            break;
+        }
+        readOffset += readBytes;
+
+        if (g_eventLoopMode)
+        {
+            if (!QueueBytes(client, fileBuffer, readBytes))
+                return false;
+        }
+        else if (RETRY_ON_INTERRUPT(send(client->socket, fileBuffer, readBytes, readOffset < length && g_corkMode ? MSG_NOSIGNAL | MSG_MORE : MSG_NOSIGNAL)) == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot send bytes to client. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            return false;
+        }
+        else
+        {
+            AddMetric(METRIC_BYTES_SENT, readBytes);
+        }
+    }
+
+    return true;
+}
+#else
+/**
+ * Copies the whole device history into the client send buffer. The ring rotates under writers,
+ * so the copy is taken while holding g_outputFileMutex and sent after releasing it. For tail
+ * echo the ring is located in the stream of appended bytes and only its unseen end is copied,
+ * anything the client was already sent is dropped again.
+ */
+bool QueueFileContents(struct Client* client, int outputFile)
+{
+    size_t startCursor = client->sendBufferCursor;
+
+    // The mapping is published like a seqlock; other writers of the device bump the generation.
+    while (g_historyMap != NULL)
+    {
+        uint64_t generation = g_historyMap->generation;
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t head = g_historyMap->head;
+        uint64_t tail = g_historyMap->tail;
+        if (generation % 2 == 1)
+            continue;
+        // A ring deeper than the mapping is read through the device instead.
+        if (head - tail > g_historyMapDataSize)
+            break;
+
+        uint64_t startOffset = tail;
+        if (g_echoMode == ECHO_TAIL && client->echoOffset != 0 && (uint64_t)client->echoOffset > tail)
+            startOffset = (uint64_t)client->echoOffset < head ? (uint64_t)client->echoOffset : head;
+        if (!ReserveSendBuffer(client, head - startOffset))
+            return false;
+
+        for (uint64_t offset = startOffset; offset < head;)
+        {
+            size_t dataOffset = offset & (g_historyMapDataSize - 1);
+            size_t chunkSize = head - offset < g_historyMapDataSize - dataOffset ? (size_t)(head - offset) : g_historyMapDataSize - dataOffset;
+            memcpy(&client->sendBuffer[client->sendBufferCursor + (offset - startOffset)], &g_historyMapData[dataOffset], chunkSize);
+            offset += chunkSize;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (g_historyMap->generation != generation)
+            continue;
+
+        client->sendBufferCursor += head - startOffset;
+        // Device offsets from here on, so the read() path below stays consistent with them.
+        g_appendedBytes = head;
+        if (g_echoMode == ECHO_TAIL)
+            client->echoOffset = head;
+        return true;
+    }
+
+    // Tail echo reads only the unseen end of the ring. Modules without llseek() report a size of 0
+    // or fail, the ring cannot be empty right after an append, so those are read whole.
+    off_t readOffset = 0;
+    if (g_echoMode == ECHO_TAIL && client->echoOffset != 0)
+    {
+        off_t ringSize = lseek(outputFile, 0, SEEK_END);
+        off_t unseenBytes = g_appendedBytes - client->echoOffset;
+        if (ringSize > 0 && unseenBytes >= 0 && unseenBytes < ringSize)
+            readOffset = ringSize - unseenBytes;
+    }
+    off_t startOffset = readOffset;
+
+    while (true)
+    {
+        if (!ReserveSendBuffer(client, 512))
+            return false;
+
+        int readBytes = RETRY_ON_INTERRUPT(pread(
+            outputFile,
+            &client->sendBuffer[client->sendBufferCursor],
+            client->sendBufferSize - client->sendBufferCursor,
+            readOffset
+        ));
+        if (readBytes == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot read from file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+            return false;
+        }
+        else if (readBytes == 0)
+        {
+            break;
+        }
+        readOffset += readBytes;
+        client->sendBufferCursor += readBytes;
+    }
+
+    if (g_echoMode == ECHO_TAIL)
+    {
+        // The read ends at the newest byte; if the ring rotated since it was sized, the start moved.
+        off_t copyOffset = g_appendedBytes - (readOffset - startOffset);
+        size_t copySize = readOffset - startOffset;
+        if (client->echoOffset != 0 && client->echoOffset > copyOffset)
+        {
+            size_t seenBytes = client->echoOffset - copyOffset < (off_t)copySize ? (size_t)(client->echoOffset - copyOffset) : copySize;
+            memmove(&client->sendBuffer[startCursor], &client->sendBuffer[startCursor + seenBytes], copySize - seenBytes);
+            client->sendBufferCursor -= seenBytes;
+        }
+        client->echoOffset = g_appendedBytes;
+    }
+    return true;
+}
+#endif
+
+#if USE_AESD_CHAR_DEVICE == 1
+/**
+ * Maps the history of the char device read-only, so echoes copy it without a read() per chunk.
+ * Modules without mmap() support keep echoing through read().
+ */
+void MapDeviceHistory()
+{
+    int outputFile = g_outputFile != -1 ? g_outputFile : open(g_outputFilePath, O_RDONLY | O_CLOEXEC);
+    if (outputFile == -1)
+    {
+        LogMessage(LOG_INFO, "Device history cannot be mapped, echoing through read(). Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        return;
+    }
+
+    // A regular file in place of the device (module not loaded) would raise SIGBUS past its end.
+    struct stat fileStatus;
+    if (fstat(outputFile, &fileStatus) == -1 || !S_ISCHR(fileStatus.st_mode))
+    {
+        LogMessage(LOG_INFO, "Output file is not a character device, echoing through read().");
+        ReleaseOutputFile(outputFile);
+        return;
+    }
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    void* header = mmap(NULL, pageSize, PROT_READ, MAP_SHARED, outputFile, 0);
+    if (header == MAP_FAILED)
+    {
+        LogMessage(LOG_INFO, "Device history cannot be mapped, echoing through read(). Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        ReleaseOutputFile(outputFile);
+        return;
+    }
+    uint64_t dataSize = ((const struct aesd_mmap_header*)header)->data_size;
+    munmap(header, pageSize);
+    // The driver publishes a power of two number of pages, anything else is not an aesdchar header.
+    if (dataSize == 0 || dataSize % pageSize != 0 || (dataSize & (dataSize - 1)) != 0 || dataSize > SIZE_MAX / 2)
+    {
+        LogMessage(LOG_INFO, "Device history header is invalid, echoing through read(). Data Size: %" PRIu64 ".", dataSize);
+        ReleaseOutputFile(outputFile);
+        return;
+    }
+
+    void* area = mmap(NULL, pageSize + dataSize, PROT_READ, MAP_SHARED, outputFile, 0);
+    ReleaseOutputFile(outputFile);
+    if (area == MAP_FAILED)
+    {
+        LogMessage(LOG_INFO, "Device history cannot be mapped, echoing through read(). Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        return;
+    }
+
+    g_historyMap = area;
+    g_historyMapData = (const char*)area + pageSize;
+    g_historyMapDataSize = dataSize;
+    g_historyMapLength = pageSize + dataSize;
+}
+#endif
+
+#ifdef USE_IO_URING
+void ReleaseUring(void* uring)
+{
+    io_uring_queue_exit(&((struct UringContext*)uring)->ring);
+    free(uring);
+}
+
+/**
+ * Returns the ring of the calling thread, set up on first use. Rings are not shared, so a thread
+ * waiting for its own send completions never holds up another thread's submissions.
+ * @return NULL if no ring can be set up, the caller falls back to blocking I/O.
+ */
+struct UringContext* CurrentUring()
+{
+    struct UringContext* uring = pthread_getspecific(g_uringKey);
+    if (uring != NULL)
+        return uring;
+
+    uring = malloc(sizeof(struct UringContext));
+    if (uring == NULL)
+        return NULL;
+
+    int initResult = io_uring_queue_init(URING_QUEUE_DEPTH, &uring->ring, 0);
+    if (initResult < 0)
+    {
+        LogMessage(LOG_WARNING, "Cannot create io_uring, using blocking I/O. Error No: %d, Error Text: \"%s\".", -initResult, strerror(-initResult));
+        free(uring);
+        return NULL;
+    }
+
+    struct iovec buffers[2] = {
+        { .iov_base = uring->buffers[0], .iov_len = URING_BUFFER_SIZE },
+        { .iov_base = uring->buffers[1], .iov_len = URING_BUFFER_SIZE },
+    };
+    int registerResult = io_uring_register_buffers(&uring->ring, buffers, 2);
+    if (registerResult == 0)
+        registerResult = io_uring_register_files(&uring->ring, &g_outputFile, 1);
+    if (registerResult < 0)
+    {
+        LogMessage(LOG_WARNING, "Cannot register io_uring resources, using blocking I/O. Error No: %d, Error Text: \"%s\".", -registerResult, strerror(-registerResult));
+        ReleaseUring(uring);
+        return NULL;
+    }
+
+    pthread_setspecific(g_uringKey, uring);
+    return uring;
+}
+
+void InitializeUring()
+{
+    // Probed once here, every thread sets up its own ring on first use.
+    struct io_uring probe;
+    int initResult = io_uring_queue_init(URING_QUEUE_DEPTH, &probe, 0);
+    if (initResult < 0)
+    {
+        LogMessage(LOG_WARNING, "io_uring is unavailable, using blocking I/O. Error No: %d, Error Text: \"%s\".", -initResult, strerror(-initResult));
+        return;
+    }
+    io_uring_queue_exit(&probe);
+
+    if (pthread_key_create(&g_uringKey, ReleaseUring) != 0)
+    {
+        LogMessage(LOG_WARNING, "Cannot create io_uring key, using blocking I/O.");
+        return;
+    }
+
+    g_uringActive = true;
+    LogMessage(LOG_INFO, "Using io_uring backend.");
+}
+
+void WaitUring(struct io_uring* ring, unsigned int count, int* results)
+{
+    int submitResult;
+    do
+        submitResult = io_uring_submit(ring);
+    while (submitResult == -EINTR);
+
+    if (submitResult < 0)
+    {
+        LogMessage(LOG_ERR, "Cannot submit io_uring requests. Error No: %d, Error Text: \"%s\".", -submitResult, strerror(-submitResult));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        struct io_uring_cqe* cqe;
+        int waitResult;
+        do
+            waitResult = io_uring_wait_cqe(ring, &cqe);
+        while (waitResult == -EINTR);
+
+        if (waitResult < 0)
+        {
+            LogMessage(LOG_ERR, "Cannot wait for io_uring completion. Error No: %d, Error Text: \"%s\".", -waitResult, strerror(-waitResult));
+            TearDownServer(EXIT_FAILURE);
+        }
+
+        results[cqe->user_data] = cqe->res;
+        io_uring_cqe_seen(ring, cqe);
+    }
+}
+
+#if USE_AESD_CHAR_DEVICE != 1
+void PrepareUringRead(struct UringContext* uring, int buffer, off_t readOffset, off_t length)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+    unsigned int chunkSize = length - readOffset < URING_BUFFER_SIZE ? (unsigned int)(length - readOffset) : URING_BUFFER_SIZE;
+    io_uring_prep_read_fixed(sqe, 0, uring->buffers[buffer], chunkSize, readOffset, buffer);
+    io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    sqe->user_data = URING_READ;
+}
+
+/**
+ * EchoFileRange() through @param uring: the range is read into the registered buffers, the next
+ * chunk is prefetched while the current one is sent.
+ */
+bool EchoFileRangeUring(struct Client* client, struct UringContext* uring, off_t readOffset, off_t length)
+{
+    if (readOffset >= length)
+        return true;
+
+    int results[URING_OPERATION_COUNT];
+    PrepareUringRead(uring, 0, readOffset, length);
+    WaitUring(&uring->ring, 1, results);
+
+    int current = 0;
+    while (true)
+    {
+        int readBytes = results[URING_READ];
+        if (readBytes < 0)
+        {
+            LogMessage(LOG_ERR, "Cannot read from file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, -readBytes, strerror(-readBytes));
+            return false;
+        }
+        else if (readBytes == 0)
+        {
+            break;
+        }
+
+        readOffset += readBytes;
+        unsigned int pending = 0;
+        if (readOffset < length)
+        {
+            PrepareUringRead(uring, 1 - current, readOffset, length);
+            pending++;
+        }
+
+        bool queueResult = true;
+        if (g_eventLoopMode)
+        {
+            queueResult = QueueBytes(client, uring->buffers[current], readBytes);
+        }
+        else
+        {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+            io_uring_prep_send(sqe, client->socket, uring->buffers[current], readBytes, MSG_NOSIGNAL);
+            sqe->user_data = URING_SEND;
+            pending++;
+        }
+
+        WaitUring(&uring->ring, pending, results);
+
+        int sendResult = queueResult ? readBytes : -ENOMEM;
+        if (!g_eventLoopMode)
+        {
+            sendResult = results[URING_SEND];
+            // Short sends are rare on blocking sockets; finish them synchronously.
+            while (sendResult >= 0 && sendResult < readBytes)
+            {
+                int sentBytes = RETRY_ON_INTERRUPT(send(client->socket, &uring->buffers[current][sendResult], readBytes - sendResult, MSG_NOSIGNAL));
+                sendResult = sentBytes == -1 ? -errno : sendResult + sentBytes;
+            }
+        }
+
+        if (sendResult < 0)
+        {
+            LogMessage(LOG_ERR, "Cannot send bytes to client. Error No: %d, Error Text: \"%s\".", -sendResult, strerror(-sendResult));
+            return false;
+        }
+
+        if (!g_eventLoopMode)
+            AddMetric(METRIC_BYTES_SENT, sendResult);
+        if (readOffset >= length)
+            break;
+        current = 1 - current;
+    }
+
+    return true;
+}
+#endif
+
+bool ProcessRecordsUring(struct Client* client, struct UringContext* uring, const struct iovec* records, size_t recordCount)
+{
+    int results[URING_OPERATION_COUNT];
+    results[URING_WRITE] = 0;
+
+    LockOutputFile();
+
+    // Records beyond IOV_MAX are written in several requests, each one completes before the next.
+    while (recordCount > 0 && results[URING_WRITE] >= 0)
+    {
+        unsigned int vectorCount = recordCount < IOV_MAX ? (unsigned int)recordCount : IOV_MAX;
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&uring->ring);
+        io_uring_prep_writev(sqe, 0, records, vectorCount, 0);
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+        sqe->user_data = URING_WRITE;
+        WaitUring(&uring->ring, 1, results);
+
+        records += vectorCount;
+        recordCount -= vectorCount;
+    }
+
+    if (results[URING_WRITE] < 0)
+    {
+        UnlockOutputFile();
+
+        LogMessage(LOG_ERR, "Cannot write to file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, -results[URING_WRITE], strerror(-results[URING_WRITE]));
+        TearDownClient(client);
+        return false;
+    }
+
+    // As in AppendAndEchoRecords(), only the append and the history snapshot are serialized.
+    #if USE_AESD_CHAR_DEVICE != 1
+        struct stat outputFileStat;
+        bool snapshotResult = fstat(g_outputFile, &outputFileStat) != -1;
+        if (!snapshotResult)
+            LogMessage(LOG_ERR, "Cannot stat file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+    #else
+        bool snapshotResult = QueueFileContents(client, g_outputFile);
+    #endif
+    UnlockOutputFile();
+
+    #if USE_AESD_CHAR_DEVICE != 1
+        if (snapshotResult)
+        {
+            snapshotResult = EchoFileRangeUring(client, uring, client->echoOffset, outputFileStat.st_size);
+            if (g_echoMode == ECHO_TAIL)
+                client->echoOffset = outputFileStat.st_size;
+        }
+    #endif
+
+    if (!snapshotResult)
+    {
+        TearDownClient(client);
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+bool WriteRecords(int outputFile, const struct iovec* records, size_t recordCount)
+{
+    // One iovec per record: the char device commits every newline-terminated segment as its own entry.
+    while (recordCount > 0)
+    {
+        int vectorCount = recordCount < IOV_MAX ? (int)recordCount : IOV_MAX;
+        if (RETRY_ON_INTERRUPT(writev(outputFile, records, vectorCount)) == -1)
+            return false;
+
+        records += vectorCount;
+        recordCount -= vectorCount;
+    }
+
+    return true;
+}
+
+/**
+ * Sends what the socket takes of the queued echo and drops @param client if the rest exceeds
+ * --max-pending.
+ * @return false if the client was torn down.
+ */
+bool FlushEcho(struct Client* client)
+{
+    if (!FlushClient(client))
+        return false;
+
+    // Only what the socket did not take counts, a long history alone is not a slow reader.
+    if (g_maxPendingBytes != 0 && PendingBytes(client) > g_maxPendingBytes)
+    {
+        LogMessage(LOG_WARNING, "Client is not reading its echo, dropping it. Client Socket: %d, Pending Bytes: %zu.", client->socket, PendingBytes(client));
+        TearDownClient(client);
+        return false;
+    }
+
+    return true;
+}
+
+bool AppendAndEchoRecords(struct Client* client, const struct iovec* records, size_t recordCount)
+{
+    #ifdef USE_IO_URING
+        // Offsets into the char device move as its ring rotates, tail echo there reads the ring instead.
+        struct UringContext* uring = NULL;
+        if (g_uringActive && !g_historyCacheMode && (USE_AESD_CHAR_DEVICE != 1 || g_echoMode == ECHO_FULL))
+            uring = CurrentUring();
+        if (uring != NULL)
+            return ProcessRecordsUring(client, uring, records, recordCount) && FlushEcho(client);
+    #endif
+
+    struct HistoryRecord* singleRecord = NULL;
+    struct HistoryRecord** historyRecords = NULL;
+    if (g_historyCacheMode)
+    {
+        historyRecords = recordCount == 1 ? &singleRecord : calloc(recordCount, sizeof(struct HistoryRecord*));
+        bool createResult = historyRecords != NULL;
+        for (size_t i = 0; createResult && i < recordCount; i++)
+        {
+            historyRecords[i] = CreateHistoryRecord(records[i].iov_base, records[i].iov_len);
+            createResult = historyRecords[i] != NULL;
+        }
+
+        if (!createResult)
+        {
+            if (historyRecords == NULL)
+                LogMessage(LOG_ERR, "Cannot allocate history record memory.");
+            for (size_t i = 0; historyRecords != NULL && i < recordCount && historyRecords[i] != NULL; i++)
+                ReleaseHistoryRecord(historyRecords[i]);
+            if (historyRecords != &singleRecord)
+                free(historyRecords);
+            TearDownClient(client);
+            return false;
+        }
+    }
+
+    LockOutputFile();
+
+    int outputFile = g_outputFile != -1 ? g_outputFile : OpenOutputFile();
+
+    if (!WriteRecords(outputFile, records, recordCount))
+    {
+        ReleaseOutputFile(outputFile);
+        UnlockOutputFile();
+
+        LogMessage(LOG_ERR, "Cannot write to file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+        for (size_t i = 0; historyRecords != NULL && i < recordCount; i++)
+            ReleaseHistoryRecord(historyRecords[i]);
+        if (historyRecords != &singleRecord)
+            free(historyRecords);
+        TearDownClient(client);
+        return false;
+    }
+    #if USE_AESD_CHAR_DEVICE == 1
+        for (size_t i = 0; i < recordCount; i++)
+            g_appendedBytes += records[i].iov_len;
+    #endif
+
+    // Only the append and the history snapshot are serialized, the echo runs unlocked.
+    bool snapshotResult = true;
+    #if USE_AESD_CHAR_DEVICE != 1
+        struct stat outputFileStat;
+    #endif
+    if (g_historyCacheMode)
+    {
+        for (size_t i = 0; i < recordCount; i++)
+        {
+            if (snapshotResult)
+                snapshotResult = AppendHistory(historyRecords[i]);
+            else
+                ReleaseHistoryRecord(historyRecords[i]);
+        }
+        if (historyRecords != &singleRecord)
+            free(historyRecords);
+
+        if (snapshotResult)
+            snapshotResult = QueueHistory(client);
+    }
+    else
+    {
+        #if USE_AESD_CHAR_DEVICE != 1
+            snapshotResult = fstat(outputFile, &outputFileStat) != -1;
+            if (!snapshotResult)
+                LogMessage(LOG_ERR, "Cannot stat file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
+        #else
+            snapshotResult = QueueFileContents(client, outputFile);
+        #endif
+    }
+    UnlockOutputFile();
+
+    #if USE_AESD_CHAR_DEVICE != 1
+        if (snapshotResult && !g_historyCacheMode)
+        {
+            snapshotResult = EchoFileRange(client, outputFile, client->echoOffset, outputFileStat.st_size);
+            if (g_echoMode == ECHO_TAIL)
+                client->echoOffset = outputFileStat.st_size;
+        }
+    #endif
+    ReleaseOutputFile(outputFile);
+
+    if (!snapshotResult)
+    {
+        TearDownClient(client);
+        return false;
+    }
+
+    return FlushEcho(client);
+}
+
+/**
+ * Appends @param records, one newline-terminated record per iovec, and echoes the resulting
+ * history to @param client once.
+ * @return false if the client was torn down.
+ */
+bool ProcessRecords(struct Client* client, const struct iovec* records, size_t recordCount)
+{
+    uint64_t startTime = MetricsClock();
+    AddMetric(METRIC_LINES_PROCESSED, recordCount);
+
+    bool result = AppendAndEchoRecords(client, records, recordCount);
+
+    ObserveMetric(METRIC_PROCESS_LATENCY, MetricsClock() - startTime);
+    return result;
+}
+
+bool ProcessPackage(struct Client* client)
+{
+    struct iovec record = { .iov_base = client->lineBuffer, .iov_len = client->lineBufferCursor };
+    if (!ProcessRecords(client, &record, 1))
+        return false;
+
+    client->lineBufferCursor = 0;
+    return true;
+}
+
+bool GrowLineBuffer(struct Client* client, size_t size)
+{
+    char* newBuffer = GrowBuffer(client->lineBuffer, &client->lineBufferSize, client->lineBufferCursor, client->lineBufferCursor + size, g_lineBufferStartSize);
+    if (newBuffer == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot reallocate line buffer memory.");
+        TearDownClient(client);
+        return false;
+    }
+    client->lineBuffer = newBuffer;
+
+    return true;
+}
+
+bool ReserveLineBuffer(struct Client* client, size_t size)
+{
+    if (g_maxLineLength != 0 && client->lineBufferCursor + size > g_maxLineLength)
+    {
+        LogMessage(LOG_WARNING, "Line exceeds the maximum length, dropping client. Client Socket: %d, Maximum Length: %zu.", client->socket, g_maxLineLength);
+        TearDownClient(client);
+        return false;
+    }
+
+    return GrowLineBuffer(client, size);
+}
+
+/**
+ * Batching variant of ParsePackage(): all records completed by @param recvBuffer are appended
+ * with one writev() and echoed once, instead of once per record.
+ */
+bool ParsePackageBatch(struct Client* client, const char* recvBuffer, size_t recvBytes)
+{
+    const char* newline = memchr(recvBuffer, '\n', recvBytes);
+    size_t spanSize = newline != NULL ? (size_t)(newline - recvBuffer) + 1 : recvBytes;
+
+    // The first record completes whatever is already buffered, the rest are referenced in place.
+    if (!ReserveLineBuffer(client, spanSize))
+        return false;
+    memcpy(&client->lineBuffer[client->lineBufferCursor], recvBuffer, spanSize);
+    client->lineBufferCursor += spanSize;
+    recvBuffer += spanSize;
+    recvBytes -= spanSize;
+
+    if (newline == NULL)
+        return true;
+
+    size_t recordCount = 0;
+    while (true)
+    {
+        if ((recordCount + 1) * sizeof(struct iovec) > client->batchRecordsSize)
+        {
+            struct iovec* newRecords = GrowBuffer(
+                client->batchRecords,
+                &client->batchRecordsSize,
+                recordCount * sizeof(struct iovec),
+                (recordCount + 1) * sizeof(struct iovec),
+                BUFFER_POOL_MIN_SIZE * 4
+            );
+            if (newRecords == NULL)
+            {
+                LogMessage(LOG_ERR, "Cannot reallocate batch memory.");
+                TearDownClient(client);
+                return false;
+            }
+            client->batchRecords = newRecords;
+        }
+
+        if (recordCount == 0)
+        {
+            client->batchRecords[0].iov_base = client->lineBuffer;
+            client->batchRecords[0].iov_len = client->lineBufferCursor;
+            recordCount++;
+            continue;
+        }
+
+        newline = memchr(recvBuffer, '\n', recvBytes);
+        if (newline == NULL)
+            break;
+
+        spanSize = (size_t)(newline - recvBuffer) + 1;
+        client->batchRecords[recordCount].iov_base = (void*)recvBuffer;
+        client->batchRecords[recordCount].iov_len = spanSize;
+        recordCount++;
+        recvBuffer += spanSize;
+        recvBytes -= spanSize;
+    }
+
+    if (!ProcessRecords(client, client->batchRecords, recordCount))
+        return false;
+
+    client->lineBufferCursor = 0;
+    if (recvBytes > 0)
+    {
+        if (!ReserveLineBuffer(client, recvBytes))
+            return false;
+        memcpy(client->lineBuffer, recvBuffer, recvBytes);
+        client->lineBufferCursor = recvBytes;
+    }
+
+    return true;
+}
+
+/**
+ * Length framing: every record is a 32-bit big-endian payload size followed by the payload. The
+ * line buffer is sized once per record and filled with plain copies, nothing is scanned. A '\n'
+ * is appended unless the payload ends with one, so each record still commits exactly one entry
+ * of the aesdchar ring; such records are appended straight from @param recvBuffer.
+ */
+bool ParseLengthPrefixed(struct Client* client, const char* recvBuffer, size_t recvBytes)
+{
+    while (recvBytes > 0)
+    {
+        if (client->recordPrefixCursor < FRAMING_PREFIX_SIZE)
+        {
+            size_t prefixBytes = FRAMING_PREFIX_SIZE - client->recordPrefixCursor;
+            if (prefixBytes > recvBytes)
+                prefixBytes = recvBytes;
+            memcpy(&client->recordPrefix[client->recordPrefixCursor], recvBuffer, prefixBytes);
+            client->recordPrefixCursor += prefixBytes;
+            recvBuffer += prefixBytes;
+            recvBytes -= prefixBytes;
+            if (client->recordPrefixCursor < FRAMING_PREFIX_SIZE)
+                return true;
+
+            client->recordSize =
+                (size_t)client->recordPrefix[0] << 24 |
+                (size_t)client->recordPrefix[1] << 16 |
+                (size_t)client->recordPrefix[2] << 8 |
+                (size_t)client->recordPrefix[3];
+
+            if (g_maxLineLength != 0 && client->recordSize > g_maxLineLength)
+            {
+                LogMessage(LOG_WARNING, "Record exceeds the maximum length, dropping client. Client Socket: %d, Record Size: %zu.", client->socket, client->recordSize);
+                TearDownClient(client);
+                return false;
+            }
+
+            const char* payload = recvBuffer;
+            if (client->recordSize > 0 && client->recordSize <= recvBytes && payload[client->recordSize - 1] == '\n')
+            {
+                struct iovec record = { .iov_base = (void*)payload, .iov_len = client->recordSize };
+                if (!ProcessRecords(client, &record, 1))
+                    return false;
+
+                recvBuffer += client->recordSize;
+                recvBytes -= client->recordSize;
+                client->recordPrefixCursor = 0;
+                continue;
+            }
+
+            // The limit applies to the payload, the appended terminator is not counted.
+            if (!GrowLineBuffer(client, client->recordSize + 1))
+                return false;
+        }
+
+        size_t payloadBytes = client->recordSize - client->lineBufferCursor;
+        if (payloadBytes > recvBytes)
+            payloadBytes = recvBytes;
+        memcpy(&client->lineBuffer[client->lineBufferCursor], recvBuffer, payloadBytes);
+        client->lineBufferCursor += payloadBytes;
+        recvBuffer += payloadBytes;
+        recvBytes -= payloadBytes;
+
+        if (client->lineBufferCursor == client->recordSize)
+        {
+            if (client->recordSize == 0 || client->lineBuffer[client->recordSize - 1] != '\n')
+                client->lineBuffer[client->lineBufferCursor++] = '\n';
+            if (!ProcessPackage(client))
+                return false;
+            client->recordPrefixCursor = 0;
+        }
+    }
+
+    return true;
+}
+
+bool ParsePackage(struct Client* client, const char* recvBuffer, size_t recvBytes)
+{
+    AddMetric(METRIC_BYTES_RECEIVED, recvBytes);
+
+    if (client->framing == FRAMING_AUTO)
+    {
+        client->framing = (uint8_t)recvBuffer[0] == FRAMING_LENGTH_HANDSHAKE ? FRAMING_LENGTH : FRAMING_LINE;
+        if (client->framing == FRAMING_LENGTH)
+        {
+            recvBuffer++;
+            recvBytes--;
+        }
+    }
+
+    if (client->framing == FRAMING_LENGTH)
+        return ParseLengthPrefixed(client, recvBuffer, recvBytes);
+
+    if (g_batchMode)
+        return ParsePackageBatch(client, recvBuffer, recvBytes);
+
+    // memchr() is vectorized by the C library, scan for delimiters and copy whole spans.
+    while (recvBytes > 0)
+    {
+        const char* newline = memchr(recvBuffer, '\n', recvBytes);
+        size_t spanSize = newline != NULL ? (size_t)(newline - recvBuffer) + 1 : recvBytes;
+
+        if (!ReserveLineBuffer(client, spanSize))
+            return false;
+
+        memcpy(&client->lineBuffer[client->lineBufferCursor], recvBuffer, spanSize);
+        client->lineBufferCursor += spanSize;
+        recvBuffer += spanSize;
+        recvBytes -= spanSize;
+
+        if (newline != NULL)
+        {
+            if (!ProcessPackage(client))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Formats the peer address for logging. IPv4 peers of a dual-stack listener are shown as IPv4,
+ * Unix domain peers are anonymous.
+ */
+const char* FormatClientAddress(const struct Client* client, char* buffer, size_t size)
+{
+    const struct sockaddr_storage* address = &client->address;
+    const char* addressText = NULL;
+    if (address->ss_family == AF_INET)
+    {
+        addressText = inet_ntop(AF_INET, &((const struct sockaddr_in*)address)->sin_addr, buffer, size);
+    }
+    else if (address->ss_family == AF_INET6)
+    {
+        const struct in6_addr* address6 = &((const struct sockaddr_in6*)address)->sin6_addr;
+        if (IN6_IS_ADDR_V4MAPPED(address6))
+            addressText = inet_ntop(AF_INET, &address6->s6_addr[12], buffer, size);
+        else
+            addressText = inet_ntop(AF_INET6, address6, buffer, size);
+    }
+    else if (address->ss_family == AF_UNIX)
+    {
+        addressText = "local";
+    }
+
+    return addressText != NULL ? addressText : "unknown";
+}
+
+void* ClientLoop(void* argument)
+{
+    struct Client* client = (struct Client*)argument;
+
+    // Wait for the acceptor to finish registering this client.
+    pthread_mutex_lock(&g_clientListMutex);
+    pthread_mutex_unlock(&g_clientListMutex);
+
+    while (!g_exitProgram)
+    {
+        char recvBuffer[512];
+        int recvBytes = RETRY_ON_INTERRUPT(recv(client->socket, recvBuffer, sizeof(recvBuffer), 0));
+        if (recvBytes == 0)
+        {
+            char addressText[INET6_ADDRSTRLEN];
+            LogMessage(LOG_INFO, "Closed connection from %s", FormatClientAddress(client, addressText, sizeof(addressText)));
+            TearDownClient(client);
+            return NULL;
+        }
+        else if (recvBytes == -1)
+        {
+            LogMessage(LOG_ERR, "Socket recv error. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownClient(client);
+            return NULL;
+        }
+
+        if (!ParsePackage(client, recvBuffer, recvBytes))
+            return NULL;
+    }
+
+    TearDownClient(client);
+    return NULL;
+}
+
+int CreateServerSocket()
+{
+    // Non-blocking: a connection reset between readiness and accept() must not stall the acceptor.
+    int serverSocket = socket(g_ipv6Mode ? AF_INET6 : AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (serverSocket == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot create socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    // A restart must not wait for the TIME_WAIT connections of the previous instance.
+    int reuseAddress = 1;
+    if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress)) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot set socket option. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        close(serverSocket);
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    // Set before listen() so accepted sockets inherit them and the window scale is negotiated for them.
+    if (g_receiveBufferSize != 0)
+    {
+        int receiveBufferSize = (int)g_receiveBufferSize;
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize)) == -1)
+            LogMessage(LOG_WARNING, "Cannot set receive buffer size. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+    }
+    if (g_sendBufferSize != 0)
+    {
+        int sendBufferSize = (int)g_sendBufferSize;
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_SNDBUF, &sendBufferSize, sizeof(sendBufferSize)) == -1)
+            LogMessage(LOG_WARNING, "Cannot set send buffer size. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+    }
+
+    if (g_eventLoopMode)
+    {
+        int reusePort = 1;
+        if (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &reusePort, sizeof(reusePort)) == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot set socket option. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            close(serverSocket);
+            TearDownServer(EXIT_FAILURE);
+        }
+    }
+
+    struct sockaddr_storage serverAddress;
+    socklen_t serverAddressSize;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    if (g_ipv6Mode)
+    {
+        // Dual stack: IPv4 clients arrive as v4-mapped addresses on the same listener.
+        int v6Only = 0;
+        if (setsockopt(serverSocket, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only)) == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot set socket option. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            close(serverSocket);
+            TearDownServer(EXIT_FAILURE);
+        }
+
+        struct sockaddr_in6* serverAddress6 = (struct sockaddr_in6*)&serverAddress;
+        serverAddress6->sin6_family = AF_INET6;
+        serverAddress6->sin6_port = htons(g_serverPort);
+        serverAddress6->sin6_addr = in6addr_any;
+        serverAddressSize = sizeof(struct sockaddr_in6);
+    }
+    else
+    {
+        struct sockaddr_in* serverAddress4 = (struct sockaddr_in*)&serverAddress;
+        serverAddress4->sin_family = AF_INET;
+        serverAddress4->sin_port = htons(g_serverPort);
+        serverAddress4->sin_addr.s_addr = htonl(INADDR_ANY);
+        serverAddressSize = sizeof(struct sockaddr_in);
+    }
+    int bindResult = bind(serverSocket, (struct sockaddr*)&serverAddress, serverAddressSize);
+    if (bindResult == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot bind socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        close(serverSocket);
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    return serverSocket;
+}
+
+/**
+ * Same line protocol as the TCP listener, co-located producers skip the TCP stack. A stale
+ * socket file left by an earlier run is replaced.
+ */
+int CreateUnixSocket()
+{
+    struct sockaddr_un unixAddress;
+    memset(&unixAddress, 0, sizeof(unixAddress));
+    unixAddress.sun_family = AF_UNIX;
+    if (strlen(g_unixSocketPath) >= sizeof(unixAddress.sun_path))
+    {
+        LogMessage(LOG_ERR, "Unix socket path is too long. Socket Path: \"%s\".", g_unixSocketPath);
+        TearDownServer(EXIT_FAILURE);
+    }
+    strcpy(unixAddress.sun_path, g_unixSocketPath);
+
+    int unixSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (unixSocket == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot create unix socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    struct stat socketStat;
+    if (stat(g_unixSocketPath, &socketStat) == 0 && S_ISSOCK(socketStat.st_mode))
+        unlink(g_unixSocketPath);
+
+    if (bind(unixSocket, (struct sockaddr*)&unixAddress, sizeof(unixAddress)) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot bind unix socket. Socket Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_unixSocketPath, errno, strerror(errno));
+        close(unixSocket);
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    return unixSocket;
+}
+
+/**
+ * Per-connection options that are not inherited from the listener.
+ */
+void ConfigureClientSocket(int clientSocket, sa_family_t family)
+{
+    if (g_noDelayMode && family != AF_UNIX)
+    {
+        // The echo is corked with MSG_MORE, so Nagle only adds a delayed-ACK stall to its tail.
+        int noDelay = 1;
+        if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) == -1)
+            LogMessage(LOG_WARNING, "Cannot disable Nagle's algorithm. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+    }
+
+    if (!g_eventLoopMode && g_sendTimeoutMs != 0)
+    {
+        struct timeval sendTimeout = {
+            .tv_sec = g_sendTimeoutMs / 1000,
+            .tv_usec = (g_sendTimeoutMs % 1000) * 1000,
+        };
+        if (setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout)) == -1)
+            LogMessage(LOG_WARNING, "Cannot set send timeout. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+    }
+}
+
+void AcceptEventLoopClients(struct Worker* worker, int serverSocket)
+{
+    while (true)
+    {
+        struct sockaddr_storage clientAddress;
+        socklen_t clientAddressSize = sizeof(clientAddress);
+        memset(&clientAddress, 0, sizeof(clientAddress));
+        int clientSocket = accept4(serverSocket, (struct sockaddr*)&clientAddress, &clientAddressSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            LogMessage(LOG_ERR, "Cannot accept socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownServer(EXIT_FAILURE);
+        }
+
+        AddMetric(METRIC_CONNECTIONS_ACCEPTED, 1);
+
+        if ((size_t)clientSocket >= g_clientTableSize)
+        {
+            LogMessage(LOG_ERR, "Client table is full. Client Socket: %d.", clientSocket);
+            close(clientSocket);
+            continue;
+        }
+
+        struct Client* newClient = AllocateClient();
+        if (newClient == NULL)
+        {
+            LogMessage(LOG_ERR, "Cannot allocate client memory.");
+            close(clientSocket);
+            continue;
+        }
+
+        newClient->socket = clientSocket;
+        newClient->framing = g_framingMode;
+        memcpy(&newClient->address, &clientAddress, sizeof(clientAddress));
+        ConfigureClientSocket(clientSocket, clientAddress.ss_family);
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = clientSocket;
+        if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, clientSocket, &event) == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot register client socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            close(clientSocket);
+            ReleaseClient(newClient);
+            continue;
+        }
+
+        newClient->worker = worker;
+        TAILQ_INSERT_TAIL(&worker->clients, newClient, entries);
+        worker->clientCount++;
+        g_clientTable[clientSocket] = newClient;
+    }
+}
+
+/**
+ * Edge triggered: drains the socket until it would block, or until the pending echo crosses the
+ * high watermark. Paused clients are resumed from HandleEventLoopClient() once they drained.
+ * @return false if the client was torn down.
+ */
+bool ReadEventLoopClient(struct Client* client)
+{
+    while (true)
+    {
+        if (g_sendHighWatermark != 0 && PendingBytes(client) >= g_sendHighWatermark)
+        {
+            client->readPaused = true;
+            return true;
+        }
+
+        char recvBuffer[4096];
+        ssize_t recvBytes = RETRY_ON_INTERRUPT(recv(client->socket, recvBuffer, sizeof(recvBuffer), 0));
+        if (recvBytes == 0 && PendingBytes(client) > 0)
+        {
+            // Half-closed, or shut down for draining: finish the echo first.
+            client->readPaused = true;
+            client->closePending = true;
+            return true;
+        }
+        else if (recvBytes == 0)
+        {
+            char addressText[INET6_ADDRSTRLEN];
+            LogMessage(LOG_INFO, "Closed connection from %s", FormatClientAddress(client, addressText, sizeof(addressText)));
+            TearDownClient(client);
+            return false;
+        }
+        else if (recvBytes == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+
+            LogMessage(LOG_ERR, "Socket recv error. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownClient(client);
+            return false;
+        }
+
+        if (!ParsePackage(client, recvBuffer, recvBytes))
+            return false;
+    }
+}
+
+void HandleEventLoopClient(struct Client* client, uint32_t events)
+{
+    if (events & EPOLLERR)
+    {
+        TearDownClient(client);
+        return;
+    }
+
+    if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !client->readPaused)
+    {
+        if (!ReadEventLoopClient(client))
+            return;
+    }
+
+    if (events & EPOLLOUT)
+    {
+        if (!FlushClient(client))
+            return;
+
+        if (client->closePending)
+        {
+            if (PendingBytes(client) == 0)
+                TearDownClient(client);
+            return;
+        }
+
+        // The edge for data that arrived while paused is gone, read it now.
+        if (client->readPaused && PendingBytes(client) <= g_sendLowWatermark)
+        {
+            client->readPaused = false;
+            ReadEventLoopClient(client);
+        }
+    }
+}
+
+/**
+ * Stops accepting and shuts down the input of every client of @param worker. Clients finish the
+ * lines they already received, flush the echo and are torn down on the resulting EOF.
+ */
+void StartWorkerDrain(struct Worker* worker)
+{
+    // The wakeup descriptor is level triggered and never drained, stop watching it.
+    epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, g_wakeupFd, NULL);
+    epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, worker->serverSocket, NULL);
+    if (g_unixSocket != -1)
+        epoll_ctl(worker->epollFd, EPOLL_CTL_DEL, g_unixSocket, NULL);
+
+    struct Client* client;
+    TAILQ_FOREACH(client, &worker->clients, entries)
+        shutdown(client->socket, SHUT_RD);
+}
+
+void* WorkerLoop(void* argument)
+{
+    struct Worker* worker = (struct Worker*)argument;
+    uint64_t drainDeadline = 0;
+
+    while (true)
+    {
+        int timeout = -1;
+        if (g_exitProgram)
+        {
+            if (drainDeadline == 0)
+            {
+                drainDeadline = MonotonicClock() + (uint64_t)g_drainTimeoutMs * 1000000;
+                StartWorkerDrain(worker);
+            }
+
+            // Stragglers left after the deadline are torn down below.
+            uint64_t now = MonotonicClock();
+            if (worker->clientCount == 0)
+                break;
+            if (now >= drainDeadline)
+            {
+                LogMessage(LOG_WARNING, "Drain deadline passed, aborting clients. Client Count: %zu.", worker->clientCount);
+                break;
+            }
+            timeout = (int)((drainDeadline - now + 999999) / 1000000);
+        }
+
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+        int eventCount = epoll_wait(worker->epollFd, events, MAX_EPOLL_EVENTS, timeout);
+        if (eventCount == -1)
+        {
+            if (errno == EINTR)
+                continue;
+
+            LogMessage(LOG_ERR, "Cannot wait for events. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownServer(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < eventCount; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == worker->serverSocket || fd == g_unixSocket)
+            {
+                AcceptEventLoopClients(worker, fd);
+            }
+            else if (fd == g_wakeupFd)
+            {
+                // Never drained, so every worker observes the shutdown request.
+                continue;
+            }
+            else if (g_clientTable[fd] != NULL && g_clientTable[fd]->worker == worker)
+            {
+                // A descriptor closed earlier in this batch may already belong to another worker.
+                HandleEventLoopClient(g_clientTable[fd], events[i].events);
+            }
+        }
+    }
+
+    while (!TAILQ_EMPTY(&worker->clients))
+        TearDownClient(TAILQ_FIRST(&worker->clients));
+    return NULL;
+}
+
+void InitializeWorker(struct Worker* worker, int serverSocket)
+{
+    worker->serverSocket = serverSocket;
+
+    int serverSocketFlags = fcntl(worker->serverSocket, F_GETFL, 0);
+    if (serverSocketFlags == -1 || fcntl(worker->serverSocket, F_SETFL, serverSocketFlags | O_NONBLOCK) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot set socket non-blocking. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (worker->epollFd == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot create epoll instance. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    struct epoll_event serverEvent;
+    memset(&serverEvent, 0, sizeof(serverEvent));
+    serverEvent.events = EPOLLIN | EPOLLET;
+    serverEvent.data.fd = worker->serverSocket;
+    if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->serverSocket, &serverEvent) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot register server socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    if (g_unixSocket != -1)
+    {
+        // Shared by all workers, only one of them is woken per incoming connection.
+        struct epoll_event unixEvent;
+        memset(&unixEvent, 0, sizeof(unixEvent));
+        unixEvent.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE;
+        unixEvent.data.fd = g_unixSocket;
+        if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, g_unixSocket, &unixEvent) == -1)
+        {
+            LogMessage(LOG_ERR, "Cannot register unix socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            TearDownServer(EXIT_FAILURE);
+        }
+    }
+
+    struct epoll_event wakeupEvent;
+    memset(&wakeupEvent, 0, sizeof(wakeupEvent));
+    wakeupEvent.events = EPOLLIN;
+    wakeupEvent.data.fd = g_wakeupFd;
+    if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, g_wakeupFd, &wakeupEvent) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot register wakeup descriptor. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+}
+
+void ExecuteEventLoop()
+{
+    if (g_workerCount == 0)
+    {
+        long onlineCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        g_workerCount = onlineCpus > 0 ? (size_t)onlineCpus : 1;
+    }
+
+    LogMessage(LOG_INFO, "Running event loop... Worker Count: %zu.", g_workerCount);
+
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == -1 || fileLimit.rlim_cur == RLIM_INFINITY)
+        fileLimit.rlim_cur = 65536;
+
+    // Sized up front so workers can index it without locking; fds are unique process wide.
+    g_clientTableSize = fileLimit.rlim_cur;
+    g_clientTable = calloc(g_clientTableSize, sizeof(struct Client*));
+    if (g_clientTable == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot allocate client table memory.");
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    g_workers = calloc(g_workerCount, sizeof(struct Worker));
+    if (g_workers == NULL)
     {
-        free(client->lineBuffer);
-        client->lineBuffer = NULL;
+        LogMessage(LOG_ERR, "Cannot allocate worker memory.");
+        TearDownServer(EXIT_FAILURE);
     }
 
-    pthread_mutex_lock(&g_clientListMutex);
-    if (g_clientListHead == client)
+    for (size_t i = 0; i < g_workerCount; i++)
     {
-        g_clientListHead = client->next;
+        g_workers[i].serverSocket = -1;
+        g_workers[i].epollFd = -1;
+        TAILQ_INIT(&g_workers[i].clients);
     }
-    else
+
+    // Every worker owns a SO_REUSEPORT listener, the kernel spreads connections among them.
+    for (size_t i = 0; i < g_workerCount; i++)
     {
-        struct Client* currentClient = g_clientListHead;
-        while (currentClient != NULL)
+        int serverSocket = g_serverSocket;
+        if (i > 0)
         {
-            if (currentClient->next == client)
+            serverSocket = CreateServerSocket();
+            if (listen(serverSocket, g_listenBacklog) == -1)
             {
-                currentClient->next = client->next;
-                break;
+                LogMessage(LOG_ERR, "Cannot listen socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+                close(serverSocket);
+                TearDownServer(EXIT_FAILURE);
             }
-            currentClient = currentClient->next;
         }
-    }
-    pthread_mutex_unlock(&g_clientListMutex);
-    free(client);
-}
-
-void TearDownServer(int exitCode)
-{
-    syslog(LOG_INFO, "Terminating server...");
-
-    g_exitProgram = true;
-
-    pthread_mutex_lock(&g_clientListMutex);
-    struct Client* currentClient = g_clientListHead;
-    while (currentClient != NULL)
-    {
-        pthread_t threadId = g_clientListHead->threadId;
-        pthread_mutex_unlock(&g_clientListMutex);
 
-        pthread_join(threadId, NULL);
+        InitializeWorker(&g_workers[i], serverSocket);
 
-        pthread_mutex_lock(&g_clientListMutex);
-        currentClient = g_clientListHead;
+        if (pthread_create(&g_workers[i].threadId, NULL, &WorkerLoop, &g_workers[i]) != 0)
+        {
+            LogMessage(LOG_ERR, "Cannot create worker thread.");
+            TearDownServer(EXIT_FAILURE);
+        }
+        g_workers[i].running = true;
     }
-    pthread_mutex_unlock(&g_clientListMutex);
-
-    g_clientListHead = NULL;
 
-    #if USE_AESD_CHAR_DEVICE != 1
-        remove(g_outputFilePath);
-    #endif
-
-    if (g_serverSocket != -1)
+    for (size_t i = 0; i < g_workerCount; i++)
     {
-        close(g_serverSocket);
-        g_serverSocket = -1;
+        pthread_join(g_workers[i].threadId, NULL);
+        g_workers[i].running = false;
     }
-
-    if (g_exitProgram)
-        syslog(LOG_ERR, "Caught signal exiting");
-
-    closelog();
-
-    sigaction(SIGTERM, &g_oldSigtermHandler, NULL);
-    sigaction(SIGTERM, &g_oldSigintHandler, NULL);
-
-    syslog(LOG_INFO, "Exiting process...");
-
-    exit(exitCode);
 }
 
-bool ProcessPackage(struct Client* client)
+void ServeMetrics(int clientSocket)
 {
-    pthread_mutex_lock(&g_outputFileMutex);
-
-    int outputFile = open(g_outputFilePath, O_RDWR | O_CREAT, 0666);
-    if (outputFile == -1)
+    // A scraper that stalls must not wedge the listener.
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(clientSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    // Any request gets the metrics, read it only so closing does not reset the connection.
+    char requestBuffer[1024];
+    ssize_t recvResult = RETRY_ON_INTERRUPT(recv(clientSocket, requestBuffer, sizeof(requestBuffer), 0));
+    (void)recvResult;
+
+    char* response = NULL;
+    size_t responseSize = 0;
+    FILE* stream = open_memstream(&response, &responseSize);
+    if (stream == NULL)
     {
-        syslog(LOG_ERR, "Cannot open file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
-        TearDownServer(EXIT_FAILURE);
+        LogMessage(LOG_ERR, "Cannot allocate metrics memory.");
+        return;
     }
 
-    if (RETRY_ON_INTERRUPT(write(outputFile, client->lineBuffer, client->lineBufferCursor)) == -1)
+    fputs("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n", stream);
+    WriteMetrics(stream);
+    if (fclose(stream) != 0)
     {
-        pthread_mutex_unlock(&g_outputFileMutex);
+        LogMessage(LOG_ERR, "Cannot allocate metrics memory.");
+        free(response);
+        return;
+    }
 
-        syslog(LOG_ERR, "Cannot write to file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
-        TearDownClient(client);
-        return false;
+    size_t sentBytes = 0;
+    while (sentBytes < responseSize)
+    {
+        ssize_t sendResult = RETRY_ON_INTERRUPT(send(clientSocket, &response[sentBytes], responseSize - sentBytes, MSG_NOSIGNAL));
+        if (sendResult == -1)
+            break;
+        sentBytes += sendResult;
     }
+    free(response);
+}
+
+void* MetricsLoop(void* argument)
+{
+    (void)argument;
 
     while (true)
     {
-        char fileBuffer[512];
-        int readBytes = RETRY_ON_INTERRUPT(read(outputFile, fileBuffer, sizeof(fileBuffer)));
-        if (readBytes == -1)
+        int clientSocket = accept4(g_metricsSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (clientSocket == -1)
         {
-            close(outputFile);
-            pthread_mutex_unlock(&g_outputFileMutex);
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
 
-            syslog(LOG_ERR, "Cannot read from file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
-            TearDownClient(client);
-            return false;
-        }
-        else if (readBytes == 0)
-        {
-            break;
+            LogMessage(LOG_ERR, "Cannot accept metrics socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+            return NULL;
         }
 
-        int sendResult = RETRY_ON_INTERRUPT(send(client->socket, fileBuffer, readBytes, 0));
-        if (sendResult == -1)
-        {
-            close(outputFile);
-            pthread_mutex_unlock(&g_outputFileMutex);
-
-            syslog(LOG_ERR, "Cannot send bytes to file. File Path: \"%s\", Error No: %d, Error Text: \"%s\".", g_outputFilePath, errno, strerror(errno));
-            TearDownClient(client);
-            return false;
-        }
+        // TearDownServer() cancels this thread, only at accept().
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        ServeMetrics(clientSocket);
+        close(clientSocket);
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
     }
-    close(outputFile);
-    pthread_mutex_unlock(&g_outputFileMutex);
-
-    client->lineBufferCursor = 0;
-
-    return true;
 }
 
-bool ParsePackage(struct Client* client, const char* recvBuffer, size_t recvBytes)
+/**
+ * The metrics listener is bound to the loopback address only, the endpoint is unauthenticated.
+ */
+void InitializeMetrics()
 {
-    for (size_t i = 0; i < recvBytes; i++)
+    if (pthread_key_create(&g_metricsKey, ReleaseThreadSlot) != 0)
     {
-        // Exponential Line Buffer Heap Allocation
-        if (client->lineBufferCursor + 1 > client->lineBufferSize)
-        {
-            if (client->lineBuffer == NULL)
-            {
-                client->lineBufferSize = g_lineBufferStartSize;
-                client->lineBuffer = malloc(client->lineBufferSize);
-                if (client->lineBuffer == NULL)
-                {
-                    syslog(LOG_ERR, "Cannot allocate line buffer memory.");
-                    TearDownClient(client);
-                    return false;
-                }
-            }
-            else
-            {
-                client->lineBufferSize *= 2;
-                client->lineBuffer = realloc(client->lineBuffer, client->lineBufferSize);
-                if (client->lineBuffer == NULL)
-                {
-                    syslog(LOG_ERR, "Cannot reallocate line buffer memory.");
-                    TearDownClient(client);
-                    return false;
-                }
-            }
-        }
+        LogMessage(LOG_ERR, "Cannot create metrics key.");
+        TearDownServer(EXIT_FAILURE);
+    }
 
-        client->lineBuffer[client->lineBufferCursor] = recvBuffer[i];
-        client->lineBufferCursor++;
+    g_metricsSocket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (g_metricsSocket == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot create metrics socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
 
-        if (recvBuffer[i] == '\n')
-        {
-            if (!ProcessPackage(client))
-                return false;
-        }
+    int reuseAddress = 1;
+    setsockopt(g_metricsSocket, SOL_SOCKET, SO_REUSEADDR, &reuseAddress, sizeof(reuseAddress));
+
+    struct sockaddr_in metricsAddress;
+    memset(&metricsAddress, 0, sizeof(metricsAddress));
+    metricsAddress.sin_family = AF_INET;
+    metricsAddress.sin_port = htons((uint16_t)g_metricsPort);
+    metricsAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(g_metricsSocket, (struct sockaddr*)&metricsAddress, sizeof(metricsAddress)) == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot bind metrics socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
     }
 
-    return true;
+    g_metricsMode = true;
 }
 
-void* ClientLoop(void* argument)
+void StartMetrics()
 {
-    pthread_mutex_lock(&g_clientListMutex);
-    struct Client* client = (struct Client*)argument;
-    client->threadId = pthread_self();
-    if (g_clientListHead == NULL)
-    {
-        g_clientListHead = client;
-    }
-    else
+    if (listen(g_metricsSocket, 4) == -1)
     {
-        struct Client* currentClient = g_clientListHead;
-        while (currentClient->next != NULL)
-            currentClient = currentClient->next;
-        currentClient->next = client;
+        LogMessage(LOG_ERR, "Cannot listen metrics socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
     }
-    pthread_mutex_unlock(&g_clientListMutex);
 
-    while (!g_exitProgram)
+    if (pthread_create(&g_metricsThreadId, NULL, &MetricsLoop, NULL) != 0)
     {
-        char recvBuffer[512];
-        int recvBytes = RETRY_ON_INTERRUPT(recv(client->socket, recvBuffer, sizeof(recvBuffer), 0));
-        if (recvBytes == 0)
-        {
-            syslog(LOG_INFO, "Closed connection from %d.%d.%d.%d",
-                (int)((uint8_t*)&client->address.sin_addr)[3],
-                (int)((uint8_t*)&client->address.sin_addr)[2],
-                (int)((uint8_t*)&client->address.sin_addr)[1],
-                (int)((uint8_t*)&client->address.sin_addr)[0]
-            );
-            TearDownClient(client);
-            return NULL;
-        }
-        else if (recvBytes == -1)
-        {
-            syslog(LOG_ERR, "Socket recv error. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
-            TearDownClient(client);
-            return NULL;
-        }
-
-        if (!ParsePackage(client, recvBuffer, recvBytes))
-            return NULL;
+        LogMessage(LOG_ERR, "Cannot create metrics thread.");
+        TearDownServer(EXIT_FAILURE);
     }
+    g_metricsRunning = true;
 
-    TearDownClient(client);
-    return NULL;
+    LogMessage(LOG_INFO, "Serving metrics... Port: %zu.", g_metricsPort);
 }
 
 void SignalHandler()
 {
-    g_exitProgram = true;
+    RequestExit();
 }
 
 void InitializeServer()
 {
-    syslog(LOG_INFO, "Initializing...");
+    LogMessage(LOG_INFO, "Initializing...");
 
     openlog(NULL, LOG_PID, LOG_USER);
-    syslog(LOG_INFO, "Started");
+    LogMessage(LOG_INFO, "Started");
 
     struct sigaction signalAction;
     memset(&signalAction, 0, sizeof(signalAction));
@@ -307,98 +2884,164 @@ void InitializeServer()
 
     if (sigaction(SIGTERM, &signalAction, &g_oldSigtermHandler) != 0)
     {
-        syslog(LOG_ERR, "Cannot register signal handler.");
+        LogMessage(LOG_ERR, "Cannot register signal handler.");
         TearDownServer(EXIT_FAILURE);
     }
 
     if (sigaction(SIGINT, &signalAction, &g_oldSigintHandler) != 0)
     {
-        syslog(LOG_ERR, "Cannot register signal handler.");
+        LogMessage(LOG_ERR, "Cannot register signal handler.");
         TearDownServer(EXIT_FAILURE);
     }
 
-    g_serverSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_serverSocket == -1)
+    // sendfile() has no MSG_NOSIGNAL, a peer that is gone must fail the call and not the process.
+    signal(SIGPIPE, SIG_IGN);
+
+    g_serverSocket = CreateServerSocket();
+    if (g_unixSocketPath != NULL)
+        g_unixSocket = CreateUnixSocket();
+
+    if (g_metricsPort != 0)
+        InitializeMetrics();
+}
+
+void AcceptThreadClient(int serverSocket)
+{
+    struct sockaddr_storage clientAddress;
+    socklen_t clientAddressSize = sizeof(clientAddress);
+    memset(&clientAddress, 0, sizeof(clientAddress));
+    int clientSocket = accept4(serverSocket, (struct sockaddr*)&clientAddress, &clientAddressSize, SOCK_CLOEXEC);
+    if (clientSocket == -1)
     {
-        syslog(LOG_ERR, "Cannot create socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNABORTED)
+            return;
+
+        LogMessage(LOG_ERR, "Cannot accept socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
         TearDownServer(EXIT_FAILURE);
     }
+    AddMetric(METRIC_CONNECTIONS_ACCEPTED, 1);
 
-    struct sockaddr_in serverAddress;
-    memset(&serverAddress, 0, sizeof(serverAddress));
-    serverAddress.sin_family = AF_INET;
-    serverAddress.sin_port = htons(9000);
-    serverAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-    int bindResult = bind(g_serverSocket, (struct sockaddr*)&serverAddress, sizeof(serverAddress));
-    if (bindResult == -1)
+    struct Client* newClient = AllocateClient();
+    if (newClient == NULL)
+    {
+        LogMessage(LOG_ERR, "Cannot allocate thread memory.");
+        TearDownServer(EXIT_FAILURE);
+    }
+
+    newClient->socket = clientSocket;
+    newClient->framing = g_framingMode;
+    memcpy(&newClient->address, &clientAddress, sizeof(clientAddress));
+    ConfigureClientSocket(clientSocket, clientAddress.ss_family);
+
+    // Registered under the lock so the thread cannot tear itself down before it is listed.
+    pthread_mutex_lock(&g_clientListMutex);
+    if (pthread_create(&newClient->threadId, NULL, &ClientLoop, newClient) != 0)
     {
-        syslog(LOG_ERR, "Cannot bind socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        pthread_mutex_unlock(&g_clientListMutex);
+
+        LogMessage(LOG_ERR, "Cannot create client thread.");
+        close(clientSocket);
+        ReleaseClient(newClient);
         TearDownServer(EXIT_FAILURE);
     }
+    TAILQ_INSERT_TAIL(&g_clients, newClient, entries);
+    pthread_mutex_unlock(&g_clientListMutex);
 }
 
 void ExecuteServer()
 {
-    int listenResult = listen(g_serverSocket, 10);
-    if (listenResult == -1)
+    // Opened after daemonizing so the descriptor outlives the per-packet critical section.
+    if (g_persistentFileMode || g_uringMode)
+        g_outputFile = OpenOutputFile();
+
+    if (g_historyCacheMode)
+        WarmUpHistory();
+    #if USE_AESD_CHAR_DEVICE == 1
+        else
+            MapDeviceHistory();
+    #endif
+
+    if (g_uringMode)
     {
-        syslog(LOG_ERR, "Cannot listen socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        #ifdef USE_IO_URING
+            InitializeUring();
+        #else
+            LogMessage(LOG_WARNING, "io_uring support is not compiled in, using blocking I/O.");
+        #endif
+    }
+
+    // The signal may land on any thread, the acceptors watch this descriptor instead of EINTR.
+    g_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wakeupFd == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot create wakeup descriptor. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
         TearDownServer(EXIT_FAILURE);
     }
 
-    while (!g_exitProgram)
+    // Started after daemonizing, threads do not survive fork().
+    StartLogFlusher();
+    if (g_metricsMode)
+        StartMetrics();
+
+    int listenResult = listen(g_serverSocket, g_listenBacklog);
+    if (listenResult == -1 || (g_unixSocket != -1 && listen(g_unixSocket, g_listenBacklog) == -1))
     {
-        struct sockaddr_in clientAddress;
-        unsigned int clientAddressSize = sizeof(clientAddressSize);
-        memset(&clientAddress, 0, sizeof(clientAddress));
-        int clientSocket = accept(g_serverSocket, (struct sockaddr*)&clientAddress, &clientAddressSize);
-        if (clientSocket == -1)
-        {
-            if (errno == EINTR && g_exitProgram)
-                TearDownServer(EXIT_SUCCESS);
+        LogMessage(LOG_ERR, "Cannot listen socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
 
-            syslog(LOG_ERR, "Cannot accept socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
-            TearDownServer(EXIT_FAILURE);
-        }
+    if (g_eventLoopMode)
+    {
+        ExecuteEventLoop();
+        return;
+    }
 
-        struct Client* newClient = (struct Client*)malloc(sizeof(struct Client));
-        if (newClient == NULL)
+    struct pollfd pollFds[3] = {
+        { .fd = g_wakeupFd, .events = POLLIN },
+        { .fd = g_serverSocket, .events = POLLIN },
+        // Negative descriptors are ignored by poll():
+        { .fd = g_unixSocket, .events = POLLIN },
+    };
+    while (!g_exitProgram)
+    {
+        if (RETRY_ON_INTERRUPT(poll(pollFds, 3, -1)) == -1)
         {
-            syslog(LOG_ERR, "Cannot allocate thread memory.");
+            LogMessage(LOG_ERR, "Cannot poll server socket. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
             TearDownServer(EXIT_FAILURE);
         }
+        if (g_exitProgram)
+            break;
 
-        memset(newClient, 0, sizeof(struct Client));
-        newClient->socket = clientSocket;
-        memcpy(&newClient->address, &clientAddress, sizeof(clientAddress));
-
-        pthread_t newThread;
-        if (pthread_create(&newThread, NULL, &ClientLoop, newClient) != 0)
+        for (size_t i = 1; i < 3; i++)
         {
-            syslog(LOG_ERR, "Cannot create client thread.");
-            free(newClient);
-            TearDownServer(EXIT_FAILURE);
+            if (pollFds[i].revents & POLLIN)
+                AcceptThreadClient(pollFds[i].fd);
         }
     }
 }
 
 void StartDaemon()
 {
-    syslog(LOG_INFO, "Forking daemon...");
+    LogMessage(LOG_INFO, "Forking daemon...");
 
     fflush(stdout);
     fflush(stderr);
 
     int pid = fork();
-    if (pid == 0)
+    if (pid == -1)
+    {
+        LogMessage(LOG_ERR, "Cannot fork daemon. Error No: %d, Error Text: \"%s\".", errno, strerror(errno));
+        TearDownServer(EXIT_FAILURE);
+    }
+    else if (pid == 0)
     {
-        syslog(LOG_INFO, "Running as daemon...");
+        LogMessage(LOG_INFO, "Running as daemon...");
 
         setsid();
 
         if (chdir("/") == -1)
         {
-            syslog(LOG_ERR, "Cannot change current working directory.");
+            LogMessage(LOG_ERR, "Cannot change current working directory.");
             TearDownServer(EXIT_FAILURE);
         }
 
@@ -413,36 +3056,130 @@ void StartDaemon()
     }
     else
     {
-        TearDownServer(EXIT_SUCCESS);
+        // The listeners and the unix socket path belong to the daemon now, leave without cleanup.
+        _exit(EXIT_SUCCESS);
     }
 }
 
 void StartApplication()
 {
-    syslog(LOG_INFO, "Running as application...");
+    LogMessage(LOG_INFO, "Running as application...");
     ExecuteServer();
     TearDownServer(EXIT_SUCCESS);
 }
 
+enum LongOption
+{
+    OPTION_MAX_LINE = 256,
+    OPTION_MAX_PENDING,
+    OPTION_SEND_TIMEOUT,
+    OPTION_HIGH_WATERMARK,
+    OPTION_LOW_WATERMARK,
+    OPTION_METRICS_PORT,
+    OPTION_DRAIN_TIMEOUT,
+    OPTION_PORT,
+    OPTION_IPV6,
+    OPTION_UNIX_SOCKET,
+    OPTION_BACKLOG,
+    OPTION_RCVBUF,
+    OPTION_SNDBUF,
+    OPTION_NO_NODELAY,
+    OPTION_NO_CORK,
+    OPTION_FRAMING,
+    OPTION_ECHO,
+};
+
+static const struct option g_longOptions[] = {
+    { "max-line", required_argument, NULL, OPTION_MAX_LINE },
+    { "max-pending", required_argument, NULL, OPTION_MAX_PENDING },
+    { "send-timeout", required_argument, NULL, OPTION_SEND_TIMEOUT },
+    { "high-watermark", required_argument, NULL, OPTION_HIGH_WATERMARK },
+    { "low-watermark", required_argument, NULL, OPTION_LOW_WATERMARK },
+    { "metrics-port", required_argument, NULL, OPTION_METRICS_PORT },
+    { "drain-timeout", required_argument, NULL, OPTION_DRAIN_TIMEOUT },
+    { "port", required_argument, NULL, OPTION_PORT },
+    { "ipv6", no_argument, NULL, OPTION_IPV6 },
+    { "unix-socket", required_argument, NULL, OPTION_UNIX_SOCKET },
+    { "backlog", required_argument, NULL, OPTION_BACKLOG },
+    { "rcvbuf", required_argument, NULL, OPTION_RCVBUF },
+    { "sndbuf", required_argument, NULL, OPTION_SNDBUF },
+    { "no-nodelay", no_argument, NULL, OPTION_NO_NODELAY },
+    { "no-cork", no_argument, NULL, OPTION_NO_CORK },
+    { "framing", required_argument, NULL, OPTION_FRAMING },
+    { "echo", required_argument, NULL, OPTION_ECHO },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 },
+};
+
 void PrintHelp()
 {
     printf(
         "aesdsocket - Simple Socket Utility\n"
         "---------------------------------------\n"
-        "Usage: aesdsocket [-d]\n"
+        "Usage: aesdsocket [-d] [-e] [-w workers] [-u] [-p] [-c] [-b] [options]\n"
         "\n"
         "Arguments:\n"
         "  -d   Run as daemon.\n"
+        "  -e   Serve clients from epoll event loops, one worker per online CPU, instead of one thread per client.\n"
+        "  -w   Number of event loop workers, implies -e. Defaults to the online CPU count.\n"
+        "  -u   Append and echo through io_uring when built with USE_IO_URING=y.\n"
+        "  -p   Keep the output file open instead of reopening it for every packet.\n"
+        "  -c   Echo from an in-memory history cache, the file is only read at startup.\n"
+        "  -b   Append all lines completed by one receive together and echo once.\n"
         "  -h   Display this help text.\n"
+        "\n"
+        "Protocol:\n"
+        "  --framing MODE          line: records end at '\\n' (default).\n"
+        "                          length: records carry a 32-bit big-endian length prefix.\n"
+        "                          auto: a leading 0x00 byte selects length framing per client.\n"
+        "  --echo MODE             full: every echo replays the whole history (default).\n"
+        "                          tail: every echo carries only the records appended since the\n"
+        "                          previous echo to that client; the first one replays everything.\n"
+        "\n"
+        "Listeners:\n"
+        "  --port PORT             TCP port. Default: 9000.\n"
+        "  --ipv6                  Listen dual-stack on [::] instead of 0.0.0.0.\n"
+        "  --unix-socket PATH      Also accept clients on a Unix domain stream socket.\n"
+        "  --backlog COUNT         Pending connection queue length. Default: SOMAXCONN.\n"
+        "\n"
+        "Socket tuning:\n"
+        "  --rcvbuf BYTES          SO_RCVBUF of client sockets. Default: kernel autotuning.\n"
+        "  --sndbuf BYTES          SO_SNDBUF of client sockets. Default: kernel autotuning.\n"
+        "  --no-nodelay            Keep Nagle's algorithm enabled on client sockets.\n"
+        "  --no-cork               Do not mark partial echo sends with MSG_MORE.\n"
+        "\n"
+        "Limits (0 disables a limit):\n"
+        "  --max-line BYTES        Drop clients sending longer lines or length-framed payloads. Default: 16777216.\n"
+        "  --max-pending BYTES     Drop clients with more unsent echo bytes. Default: 67108864.\n"
+        "  --send-timeout MS       Drop threaded clients blocking a send this long. Default: 30000.\n"
+        "  --high-watermark BYTES  Event loop stops reading a client above this many unsent bytes. Default: 1048576.\n"
+        "  --low-watermark BYTES   ...and resumes once it drained below this. Default: 262144.\n"
+        "  --drain-timeout MS      On shutdown, wait this long for clients to finish their echo. Default: 2000.\n"
+        "\n"
+        "Monitoring:\n"
+        "  --metrics-port PORT     Serve Prometheus metrics on 127.0.0.1:PORT. Default: disabled.\n"
     );
 }
 
+size_t ParseSizeArgument(const char* argument)
+{
+    char* end = NULL;
+    errno = 0;
+    unsigned long long value = strtoull(argument, &end, 10);
+    if (end == argument || *end != '\0' || errno != 0 || argument[0] == '-')
+    {
+        PrintHelp();
+        exit(EXIT_FAILURE);
+    }
+    return (size_t)value;
+}
+
 int main(int argc, char** argv)
 {
     bool daemonMode = false;
 
     int opt;
-    while ((opt = getopt(argc, argv, "dh")) != -1)
+    while ((opt = getopt_long(argc, argv, "dew:upcbh", g_longOptions, NULL)) != -1)
     {
         switch (opt)
         {
@@ -450,6 +3187,153 @@ int main(int argc, char** argv)
                 daemonMode = true;
                 break;
 
+            case 'e':
+                g_eventLoopMode = true;
+                break;
+
+            case 'u':
+                g_uringMode = true;
+                break;
+
+            case 'p':
+                g_persistentFileMode = true;
+                break;
+
+            case 'c':
+                g_historyCacheMode = true;
+                break;
+
+            case 'b':
+                g_batchMode = true;
+                break;
+
+            case 'w':
+                g_workerCount = ParseSizeArgument(optarg);
+                if (g_workerCount < 1)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                g_eventLoopMode = true;
+                break;
+
+            case OPTION_MAX_LINE:
+                g_maxLineLength = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_MAX_PENDING:
+                g_maxPendingBytes = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_SEND_TIMEOUT:
+                g_sendTimeoutMs = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_HIGH_WATERMARK:
+                g_sendHighWatermark = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_LOW_WATERMARK:
+                g_sendLowWatermark = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_PORT:
+            {
+                size_t port = ParseSizeArgument(optarg);
+                if (port == 0 || port > UINT16_MAX)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                g_serverPort = (uint16_t)port;
+                break;
+            }
+
+            case OPTION_FRAMING:
+                if (strcmp(optarg, "line") == 0)
+                    g_framingMode = FRAMING_LINE;
+                else if (strcmp(optarg, "length") == 0)
+                    g_framingMode = FRAMING_LENGTH;
+                else if (strcmp(optarg, "auto") == 0)
+                    g_framingMode = FRAMING_AUTO;
+                else
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case OPTION_ECHO:
+                if (strcmp(optarg, "full") == 0)
+                    g_echoMode = ECHO_FULL;
+                else if (strcmp(optarg, "tail") == 0)
+                    g_echoMode = ECHO_TAIL;
+                else
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case OPTION_BACKLOG:
+            {
+                size_t backlog = ParseSizeArgument(optarg);
+                if (backlog == 0 || backlog > INT_MAX)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                g_listenBacklog = (int)backlog;
+                break;
+            }
+
+            case OPTION_RCVBUF:
+                g_receiveBufferSize = ParseSizeArgument(optarg);
+                if (g_receiveBufferSize > INT_MAX / 2)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case OPTION_SNDBUF:
+                g_sendBufferSize = ParseSizeArgument(optarg);
+                if (g_sendBufferSize > INT_MAX / 2)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case OPTION_NO_NODELAY:
+                g_noDelayMode = false;
+                break;
+
+            case OPTION_NO_CORK:
+                g_corkMode = false;
+                break;
+
+            case OPTION_IPV6:
+                g_ipv6Mode = true;
+                break;
+
+            case OPTION_UNIX_SOCKET:
+                g_unixSocketPath = optarg;
+                break;
+
+            case OPTION_DRAIN_TIMEOUT:
+                g_drainTimeoutMs = ParseSizeArgument(optarg);
+                break;
+
+            case OPTION_METRICS_PORT:
+                g_metricsPort = ParseSizeArgument(optarg);
+                if (g_metricsPort > UINT16_MAX)
+                {
+                    PrintHelp();
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             case 'h':
                 PrintHelp();
                 exit(EXIT_SUCCESS);
@@ -462,6 +3346,9 @@ int main(int argc, char** argv)
         }
     }
 
+    if (g_sendLowWatermark > g_sendHighWatermark)
+        g_sendLowWatermark = g_sendHighWatermark;
+
     InitializeServer();
 
     if (daemonMode)
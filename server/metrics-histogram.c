@@ -0,0 +1,36 @@
+#include "metrics-histogram.h"
+
+/**
+ * HDR-style log-linear bucketing: the octave of @param nanoseconds (in ~1us units) plus the bits
+ * below its leading one select the bucket, so every bucket has the same relative width. Buckets
+ * include their upper bound, as Prometheus' le label does.
+ */
+size_t MetricsBucket(uint64_t nanoseconds)
+{
+    if (nanoseconds <= 1 << METRICS_HISTOGRAM_UNIT_SHIFT)
+        return 0;
+
+    uint64_t value = nanoseconds - 1;
+    unsigned int leadingBit = 63 - __builtin_clzll(value);
+    unsigned int octave = leadingBit - METRICS_HISTOGRAM_UNIT_SHIFT;
+    if (octave >= METRICS_HISTOGRAM_OCTAVES)
+        return METRICS_HISTOGRAM_BUCKETS - 1;
+
+    // Taken from the nanoseconds, the unit count has fewer bits than that in the lowest octaves.
+    uint64_t subBucket = value >> (leadingBit - METRICS_HISTOGRAM_SUB_BUCKET_BITS);
+    return 1 + octave * METRICS_HISTOGRAM_SUB_BUCKETS + (subBucket & (METRICS_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * @return the inclusive upper bound of @param bucket in seconds.
+ */
+double MetricsBucketBound(size_t bucket)
+{
+    if (bucket == 0)
+        return (double)(1 << METRICS_HISTOGRAM_UNIT_SHIFT) * 1e-9;
+
+    size_t octave = (bucket - 1) / METRICS_HISTOGRAM_SUB_BUCKETS;
+    size_t subBucket = (bucket - 1) % METRICS_HISTOGRAM_SUB_BUCKETS;
+    uint64_t scaledBound = (uint64_t)(METRICS_HISTOGRAM_SUB_BUCKETS + subBucket + 1) << (octave + METRICS_HISTOGRAM_UNIT_SHIFT);
+    return (double)scaledBound / METRICS_HISTOGRAM_SUB_BUCKETS * 1e-9;
+}
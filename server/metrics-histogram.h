@@ -0,0 +1,25 @@
+/*
+ * metrics-histogram.h
+ *
+ * Log-linear latency buckets of the aesdsocket --metrics-port histograms.
+ */
+
+#ifndef METRICS_HISTOGRAM_H
+#define METRICS_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_HISTOGRAM_UNIT_SHIFT 10
+#define METRICS_HISTOGRAM_OCTAVES 28
+// Eight buckets per octave, each at most 12.5% wide:
+#define METRICS_HISTOGRAM_SUB_BUCKET_BITS 3
+#define METRICS_HISTOGRAM_SUB_BUCKETS (1 << METRICS_HISTOGRAM_SUB_BUCKET_BITS)
+// Sub-microsecond bucket, the log-linear buckets and an overflow bucket:
+#define METRICS_HISTOGRAM_BUCKETS (METRICS_HISTOGRAM_OCTAVES * METRICS_HISTOGRAM_SUB_BUCKETS + 2)
+
+size_t MetricsBucket(uint64_t nanoseconds);
+
+double MetricsBucketBound(size_t bucket);
+
+#endif /* METRICS_HISTOGRAM_H */
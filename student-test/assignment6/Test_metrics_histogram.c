@@ -0,0 +1,56 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../server/metrics-histogram.h"
+
+/**
+ * @return the inclusive upper bound of @param bucket in nanoseconds, as MetricsBucketBound() computes it.
+ */
+static uint64_t bucket_bound_ns(size_t bucket)
+{
+    size_t octave = (bucket - 1) / METRICS_HISTOGRAM_SUB_BUCKETS;
+    size_t sub_bucket = (bucket - 1) % METRICS_HISTOGRAM_SUB_BUCKETS;
+    return ((uint64_t)(METRICS_HISTOGRAM_SUB_BUCKETS + sub_bucket + 1) << (octave + METRICS_HISTOGRAM_UNIT_SHIFT)) / METRICS_HISTOGRAM_SUB_BUCKETS;
+}
+
+void test_metrics_bucket_edges()
+{
+    TEST_ASSERT_EQUAL_UINT32(0, MetricsBucket(0));
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, MetricsBucket(1 << METRICS_HISTOGRAM_UNIT_SHIFT), "The first bound is not inclusive");
+    TEST_ASSERT_EQUAL_UINT32(1, MetricsBucket((1 << METRICS_HISTOGRAM_UNIT_SHIFT) + 1));
+
+    uint64_t lower_bound = 1 << METRICS_HISTOGRAM_UNIT_SHIFT;
+    for (size_t bucket = 1; bucket < METRICS_HISTOGRAM_BUCKETS - 1; bucket++)
+    {
+        uint64_t upper_bound = bucket_bound_ns(bucket);
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(bucket, MetricsBucket(lower_bound + 1), "First nanosecond above the previous bound is not in the bucket");
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(bucket, MetricsBucket(upper_bound), "Bound itself is not in the bucket");
+        TEST_ASSERT_TRUE_MESSAGE((double)upper_bound * 1e-9 <= MetricsBucketBound(bucket), "Exported bound is below the bucket's samples");
+        TEST_ASSERT_TRUE_MESSAGE((double)lower_bound * 1e-9 >= MetricsBucketBound(bucket - 1), "Exported bound of the previous bucket is above its samples");
+        lower_bound = upper_bound;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(METRICS_HISTOGRAM_BUCKETS - 1, MetricsBucket(lower_bound + 1), "Samples above the last bound do not overflow");
+    TEST_ASSERT_EQUAL_UINT32(METRICS_HISTOGRAM_BUCKETS - 1, MetricsBucket(UINT64_MAX));
+}
+
+void test_metrics_bucket_samples()
+{
+    // Every nanosecond of the lowest octaves, where the microsecond unit has no fraction bits:
+    for (uint64_t nanoseconds = 0; nanoseconds < (uint64_t)64 << METRICS_HISTOGRAM_UNIT_SHIFT; nanoseconds++)
+    {
+        size_t bucket = MetricsBucket(nanoseconds);
+        TEST_ASSERT_TRUE_MESSAGE((double)nanoseconds * 1e-9 <= MetricsBucketBound(bucket), "Sample is above its bucket's bound");
+        if (bucket > 0)
+            TEST_ASSERT_TRUE_MESSAGE((double)nanoseconds * 1e-9 > MetricsBucketBound(bucket - 1), "Sample is at or below the previous bucket's bound");
+    }
+}
+
+void test_metrics_bucket_width()
+{
+    for (size_t bucket = 2; bucket < METRICS_HISTOGRAM_BUCKETS - 1; bucket++)
+    {
+        double width = MetricsBucketBound(bucket) - MetricsBucketBound(bucket - 1);
+        TEST_ASSERT_TRUE_MESSAGE(width <= MetricsBucketBound(bucket - 1) / 8 * 1.000001, "Bucket is wider than 12.5% of its lower bound");
+    }
+}
@@ -0,0 +1,209 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <string.h>
+#include "../../aesd-char-driver/aesd-circular-buffer.h"
+
+static const char* const writes[] = {
+    "write1\n", "write22\n", "write333\n", "write4444\n", "write55555\n",
+    "w6\n", "write7\n", "write88\n", "write999\n", "write10\n",
+    "write11\n", "w12\n", "write13!!\n", "write14\n", "write15\n",
+};
+
+static void add_write(struct aesd_circular_buffer* buffer, const char* write)
+{
+    struct aesd_buffer_entry entry = {
+        .buffptr = (char*)write,
+        .size = strlen(write),
+    };
+    aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+/**
+ * Checks that every byte in [first, first + size) of the stream of @param buffer is found at the
+ * matching byte of @param expected.
+ */
+static void verify_every_offset(struct aesd_circular_buffer* buffer, const char* expected)
+{
+    size_t expected_size = strlen(expected);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(expected_size, buffer->total_size, "total_size does not match the stored writes");
+    for (size_t offset = 0; offset < expected_size; offset++)
+    {
+        size_t entry_offset = 0;
+        struct aesd_buffer_entry* entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, offset, &entry_offset);
+        TEST_ASSERT_NOT_NULL_MESSAGE(entry, "No entry found for an offset inside the stored writes");
+        TEST_ASSERT_TRUE_MESSAGE(entry_offset < entry->size, "Entry offset is beyond the returned entry");
+        TEST_ASSERT_EQUAL_INT8_MESSAGE(expected[offset], entry->buffptr[entry_offset], "Offset maps to the wrong byte");
+    }
+}
+
+void test_circular_buffer_seek_entry_boundaries()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    for (size_t i = 0; i < 5; i++)
+        add_write(&buffer, writes[i]);
+
+    size_t boundary = 0;
+    for (size_t i = 0; i < 5; i++)
+    {
+        size_t entry_offset = 1234;
+        struct aesd_buffer_entry* entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, boundary, &entry_offset);
+        TEST_ASSERT_NOT_NULL(entry);
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[i], entry->buffptr, "Boundary offset does not map to the entry starting there");
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, entry_offset, "Boundary offset is not the first byte of its entry");
+
+        if (boundary > 0)
+        {
+            entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, boundary - 1, &entry_offset);
+            TEST_ASSERT_NOT_NULL(entry);
+            TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[i - 1], entry->buffptr, "Byte before a boundary does not map to the previous entry");
+            TEST_ASSERT_EQUAL_UINT32(strlen(writes[i - 1]) - 1, entry_offset);
+        }
+        boundary += strlen(writes[i]);
+    }
+}
+
+void test_circular_buffer_seek_wrapped()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    char expected[256] = "";
+    for (size_t i = 0; i < 15; i++)
+    {
+        add_write(&buffer, writes[i]);
+        if (i >= 15 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+            strcat(expected, writes[i]);
+    }
+
+    TEST_ASSERT_TRUE_MESSAGE(buffer.full, "Buffer is not full after overwriting entries");
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, buffer.out_offs, "Oldest entry is expected away from slot 0");
+    TEST_ASSERT_EQUAL_UINT32(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, aesd_circular_buffer_get_count(&buffer));
+    verify_every_offset(&buffer, expected);
+
+    size_t dropped = 0;
+    for (size_t i = 0; i < 15 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i++)
+        dropped += strlen(writes[i]);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(dropped, aesd_circular_buffer_first_offset(&buffer), "first_offset does not count the overwritten entries");
+}
+
+void test_circular_buffer_seek_past_end()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    size_t entry_offset = 1234;
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry_offset), "Empty buffer returned an entry");
+
+    for (size_t i = 0; i < 12; i++)
+        add_write(&buffer, writes[i]);
+
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, buffer.total_size, &entry_offset), "Offset at the end returned an entry");
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, buffer.total_size + 100, &entry_offset), "Offset past the end returned an entry");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(1234, entry_offset, "Entry offset changed although no entry was found");
+
+    struct aesd_buffer_entry* entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, buffer.total_size - 1, &entry_offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[11], entry->buffptr, "Last byte does not map to the newest entry");
+    TEST_ASSERT_EQUAL_UINT32(strlen(writes[11]) - 1, entry_offset);
+}
+
+void test_circular_buffer_remove_then_seek()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry removed;
+    aesd_circular_buffer_init(&buffer);
+    TEST_ASSERT_FALSE_MESSAGE(aesd_circular_buffer_remove_entry(&buffer, &removed), "Removed an entry from an empty buffer");
+
+    // writes[3] to writes[12] are kept, the first four of them are removed below:
+    char expected[256] = "";
+    for (size_t i = 0; i < 13; i++)
+    {
+        add_write(&buffer, writes[i]);
+        if (i >= 13 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 4)
+            strcat(expected, writes[i]);
+    }
+
+    size_t first_offset = aesd_circular_buffer_first_offset(&buffer);
+    for (size_t i = 13 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; i < 13 - AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED + 4; i++)
+    {
+        TEST_ASSERT_TRUE(aesd_circular_buffer_remove_entry(&buffer, &removed));
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[i], removed.buffptr, "Removal did not return the oldest entry");
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(first_offset, removed.start_offs, "Removed entry has the wrong start offset");
+        first_offset += removed.size;
+        TEST_ASSERT_EQUAL_UINT32(first_offset, aesd_circular_buffer_first_offset(&buffer));
+    }
+    TEST_ASSERT_FALSE_MESSAGE(buffer.full, "Buffer still full after removals");
+    TEST_ASSERT_EQUAL_UINT32(AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 4, aesd_circular_buffer_get_count(&buffer));
+    verify_every_offset(&buffer, expected);
+
+    // Refill past the removed slots, the search must follow the new oldest entry.
+    for (size_t i = 13; i < 15; i++)
+    {
+        add_write(&buffer, writes[i]);
+        strcat(expected, writes[i]);
+    }
+    verify_every_offset(&buffer, expected);
+
+    while (aesd_circular_buffer_remove_entry(&buffer, &removed))
+        ;
+    size_t entry_offset = 0;
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, buffer.total_size, "Emptied buffer still has a size");
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(buffer.end_offs, aesd_circular_buffer_first_offset(&buffer), "Emptied buffer does not start at its end");
+    TEST_ASSERT_NULL(aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, 0, &entry_offset));
+}
+
+void test_circular_buffer_iter_seek_next()
+{
+    struct aesd_circular_buffer buffer;
+    aesd_circular_buffer_init(&buffer);
+    for (size_t i = 0; i < 14; i++)
+        add_write(&buffer, writes[i]);
+
+    // Oldest entry is writes[4], land one byte into writes[6]:
+    size_t offset = strlen(writes[4]) + strlen(writes[5]) + 1;
+    struct aesd_circular_buffer_iter iter;
+    size_t entry_offset = 0;
+    struct aesd_buffer_entry* entry = aesd_circular_buffer_iter_seek(&buffer, &iter, offset, &entry_offset);
+    TEST_ASSERT_NOT_NULL(entry);
+    TEST_ASSERT_EQUAL_PTR(writes[6], entry->buffptr);
+    TEST_ASSERT_EQUAL_UINT32(1, entry_offset);
+
+    for (size_t i = 7; i < 14; i++)
+    {
+        entry = aesd_circular_buffer_iter_next(&buffer, &iter);
+        TEST_ASSERT_NOT_NULL_MESSAGE(entry, "Iteration ended before the newest entry");
+        TEST_ASSERT_EQUAL_PTR_MESSAGE(writes[i], entry->buffptr, "Iteration skipped or repeated an entry");
+    }
+    TEST_ASSERT_NULL_MESSAGE(aesd_circular_buffer_iter_next(&buffer, &iter), "Iteration continued past the newest entry");
+    TEST_ASSERT_NULL(aesd_circular_buffer_iter_next(&buffer, &iter));
+}
+
+void test_circular_buffer_init_storage()
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entries[3];
+    memset(entries, 0xff, sizeof(entries));
+    aesd_circular_buffer_init_storage(&buffer, entries, 3);
+    TEST_ASSERT_EQUAL_PTR(entries, buffer.entry);
+    TEST_ASSERT_EQUAL_UINT32(3, buffer.capacity);
+    TEST_ASSERT_EQUAL_UINT32(0, aesd_circular_buffer_get_count(&buffer));
+    TEST_ASSERT_NULL_MESSAGE(entries[2].buffptr, "Caller owned slots were not cleared");
+
+    char expected[64] = "";
+    for (size_t i = 0; i < 5; i++)
+    {
+        add_write(&buffer, writes[i]);
+        if (i >= 2)
+            strcat(expected, writes[i]);
+    }
+    TEST_ASSERT_TRUE(buffer.full);
+    TEST_ASSERT_EQUAL_UINT32(3, aesd_circular_buffer_get_count(&buffer));
+    verify_every_offset(&buffer, expected);
+
+    struct aesd_circular_buffer_iter iter;
+    size_t entry_offset = 0;
+    struct aesd_buffer_entry* entry = aesd_circular_buffer_iter_seek(&buffer, &iter, 0, &entry_offset);
+    TEST_ASSERT_EQUAL_PTR(writes[2], entry->buffptr);
+    TEST_ASSERT_EQUAL_PTR(writes[3], aesd_circular_buffer_iter_next(&buffer, &iter)->buffptr);
+    TEST_ASSERT_EQUAL_PTR(writes[4], aesd_circular_buffer_iter_next(&buffer, &iter)->buffptr);
+    TEST_ASSERT_NULL(aesd_circular_buffer_iter_next(&buffer, &iter));
+}